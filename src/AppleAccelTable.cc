@@ -0,0 +1,162 @@
+#include "AppleAccelTable.h"
+#include <stdio.h>
+#include <string.h>
+#include "dwarf32.h"
+
+
+namespace {
+  struct AppleAccelHdr {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t hash_function;
+    uint32_t bucket_count;
+    uint32_t hashes_count;
+    uint32_t header_data_len;
+    uint32_t die_offset_base;
+    uint32_t atom_count;
+  } __attribute__((packed, aligned(1)));
+
+  struct Atom {
+    uint16_t type;
+    uint16_t form;
+  } __attribute__((packed, aligned(1)));
+
+  const uint32_t kAppleMagic = 0x48415348;  // 'HASH'
+  const uint32_t kEmptyBucket = UINT32_MAX;
+
+  enum AtomType {
+    DW_ATOM_die_offset = 1,
+    DW_ATOM_cu_offset = 2,
+    DW_ATOM_die_tag = 3,
+    DW_ATOM_type_flags = 5,
+    DW_ATOM_qual_name_hash = 6
+  };
+
+  bool AtomSize(uint16_t form, size_t& size) {
+    switch (form) {
+      case Dwarf32::Form::DW_FORM_data1:
+      case Dwarf32::Form::DW_FORM_flag:
+        size = 1;
+        return true;
+      case Dwarf32::Form::DW_FORM_data2:
+        size = 2;
+        return true;
+      case Dwarf32::Form::DW_FORM_data4:
+      case Dwarf32::Form::DW_FORM_ref4:
+      case Dwarf32::Form::DW_FORM_sec_offset:
+        size = 4;
+        return true;
+      case Dwarf32::Form::DW_FORM_data8:
+      case Dwarf32::Form::DW_FORM_ref8:
+        size = 8;
+        return true;
+      default:
+        fprintf(stderr, "ERR: Unexpected Apple accelerator table form 0x%x\n", form);
+        return false;
+    }
+  }
+}
+
+// static
+uint32_t AppleAccelTable::Hash(const char* name) {
+  uint32_t hash = 5381;
+  for (const unsigned char* c = reinterpret_cast<const unsigned char*>(name); *c; c++) {
+    hash = hash * 33 + *c;
+  }
+  return hash;
+}
+
+bool AppleAccelTable::Lookup(const char* name, std::vector<Entry>& entries) const {
+  if (size_ < sizeof(AppleAccelHdr)) {
+    return false;
+  }
+
+  const AppleAccelHdr* header = reinterpret_cast<const AppleAccelHdr*>(data_);
+  if (header->magic != kAppleMagic || header->version != 1 || header->hash_function != 0) {
+    fprintf(stderr, "ERR: Unsupported Apple accelerator table\n");
+    return false;
+  }
+
+  // The header data (die_offset_base, atom_count and atoms) is followed by
+  // the buckets, the hashes and the offsets of the hash data
+  const Atom* atoms = reinterpret_cast<const Atom*>(data_ + sizeof(AppleAccelHdr));
+  const unsigned char* tables = data_ + offsetof(AppleAccelHdr, die_offset_base) + header->header_data_len;
+  uint64_t tables_size = (static_cast<uint64_t>(header->bucket_count) + 2 * header->hashes_count) * sizeof(uint32_t);
+  if (sizeof(AppleAccelHdr) + header->atom_count * sizeof(Atom) > size_ || 
+      tables < data_ || tables + tables_size > data_ + size_) {
+    fprintf(stderr, "ERR: Truncated Apple accelerator table\n");
+    return false;
+  }
+  const uint32_t* buckets = reinterpret_cast<const uint32_t*>(tables);
+  const uint32_t* hashes = buckets + header->bucket_count;
+  const uint32_t* offsets = hashes + header->hashes_count;
+
+  // The size of each value of a name
+  size_t entry_size = 0;
+  for (uint32_t i = 0; i < header->atom_count; i++) {
+    size_t atom_size = 0;
+    if (!AtomSize(atoms[i].form, atom_size)) {
+      return false;
+    }
+    entry_size += atom_size;
+  }
+
+  if (!header->bucket_count) {
+    return true;
+  }
+  uint32_t hash = AppleAccelTable::Hash(name);
+  uint32_t bucket = hash % header->bucket_count;
+  uint32_t index = buckets[bucket];
+  if (index == kEmptyBucket) {
+    return true;
+  }
+
+  // The hashes of a bucket are contiguous
+  for (uint32_t i = index; i < header->hashes_count; i++) {
+    if (hashes[i] % header->bucket_count != bucket) {
+      break;
+    }
+    if (hashes[i] != hash) {
+      continue;
+    }
+
+    // Several names can share the same hash, the list ends with a 0 string
+    // offset
+    const unsigned char* ptr = data_ + offsets[i];
+    const unsigned char* end = data_ + size_;
+    while (ptr + 2 * sizeof(uint32_t) <= end) {
+      uint32_t str_offset = *reinterpret_cast<const uint32_t*>(ptr);
+      if (!str_offset) {
+        break;
+      }
+      uint32_t count = *reinterpret_cast<const uint32_t*>(ptr + sizeof(uint32_t));
+      ptr += 2 * sizeof(uint32_t);
+      if (ptr + static_cast<uint64_t>(count) * entry_size > end) {
+        return false;
+      }
+
+      bool match = str_offset < debug_str_size_ && !strcmp(debug_str_ + str_offset, name);
+      for (uint32_t j = 0; j < count; j++) {
+        Entry entry = {UINT64_MAX, 0};
+        for (uint32_t k = 0; k < header->atom_count; k++) {
+          size_t atom_size = 0;
+          AtomSize(atoms[k].form, atom_size);
+          uint64_t value = 0;
+          memcpy(&value, ptr, atom_size);  // Little endian
+          ptr += atom_size;
+
+          if (atoms[k].type == DW_ATOM_die_offset) {
+            entry.die_offset = value + header->die_offset_base;
+          } else if (atoms[k].type == DW_ATOM_die_tag) {
+            entry.tag = value;
+          }
+        }
+        if (match && entry.die_offset != UINT64_MAX) {
+          entries.push_back(entry);
+        }
+      }
+    }
+  }
+
+  return true;
+}
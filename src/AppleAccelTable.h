@@ -0,0 +1,30 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+
+// Reader of the Apple accelerator tables (__apple_types, __apple_names)
+// emitted by the Apple toolchains in the __DWARF segment
+class AppleAccelTable {
+public:
+  struct Entry {
+    uint64_t die_offset;    // Absolute offset in .debug_info
+    uint32_t tag;           // 0 when the table has no DW_ATOM_die_tag
+  };
+
+  AppleAccelTable(const unsigned char* data, size_t size, const char* debug_str, size_t debug_str_size)
+      : data_(data), size_(size), debug_str_(debug_str), debug_str_size_(debug_str_size) {}
+
+  // Append to entries all the DIEs indexed under name
+  bool Lookup(const char* name, std::vector<Entry>& entries) const;
+
+  static uint32_t Hash(const char* name);
+
+
+private:
+  const unsigned char* data_;
+  size_t size_;
+  const char* debug_str_;
+  size_t debug_str_size_;
+};
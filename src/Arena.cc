@@ -0,0 +1,26 @@
+#include "Arena.h"
+
+
+namespace {
+  char* Align(char* memory, size_t alignment) {
+    return memory + (alignment - reinterpret_cast<uintptr_t>(memory) % alignment) % alignment;
+  }
+}
+
+void* Arena::Allocate(size_t size, size_t alignment) {
+  char* memory = Align(next_, alignment);
+  if (!next_ || memory + size > next_ + available_) {
+    // The end of the current block is lost
+    if (blocks_.size() == blocks_.capacity()) {
+      heap_allocations_++;
+    }
+    blocks_.emplace_back(new char[kBlockSize]);
+    heap_allocations_++;
+    next_ = blocks_.back().get();
+    available_ = kBlockSize;
+    memory = Align(next_, alignment);
+  }
+  available_ -= memory + size - next_;
+  next_ = memory + size;
+  return memory;
+}
@@ -0,0 +1,133 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+
+// Memory allocated by bumping a pointer in big blocks, and freed all at once
+// with the arena. It isn't thread safe: each builder has its own.
+class Arena {
+public:
+  Arena() = default;
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  // At most kMaxSize bytes, the end of the current block is lost when they
+  // don't fit in it
+  static constexpr size_t kMaxSize = 256 << 10;
+  void* Allocate(size_t size, size_t alignment);
+
+  // The heap allocations made for the arena and the containers using it: its
+  // blocks, their big allocations and their indexes
+  uint64_t HeapAllocations() const { return heap_allocations_; }
+  void CountHeapAllocation() { heap_allocations_++; }
+
+private:
+  static constexpr size_t kBlockSize = 1 << 20;
+
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  char* next_ = nullptr;        // In the last block
+  size_t available_ = 0;
+  uint64_t heap_allocations_ = 0;
+};
+
+// Allocator of the standard containers, the memory is only freed with the
+// arena. The big allocations, like the buckets of a growing map, are
+// reallocated rather than added to: they are on the heap.
+template <typename T>
+class ArenaAllocator {
+public:
+  typedef T value_type;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  explicit ArenaAllocator(Arena* arena) : arena_(arena) {}
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena_) {}
+
+  T* allocate(size_t count) {
+    if (count * sizeof(T) > Arena::kMaxSize) {
+      arena_->CountHeapAllocation();
+      return std::allocator<T>().allocate(count);
+    }
+    return static_cast<T*>(arena_->Allocate(count * sizeof(T), alignof(T)));
+  }
+  void deallocate(T* memory, size_t count) {
+    if (count * sizeof(T) > Arena::kMaxSize) {
+      std::allocator<T>().deallocate(memory, count);
+    }
+  }
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U>& other) const { return arena_ == other.arena_; }
+  template <typename U>
+  bool operator!=(const ArenaAllocator<U>& other) const { return arena_ != other.arena_; }
+
+private:
+  template <typename U> friend class ArenaAllocator;
+  Arena* arena_;
+};
+
+// Array of trivial values stored by chunks of the arena. The values never
+// move: the array grows by a chunk without copying them, and keeps its chunks
+// when it shrinks.
+template <typename T>
+class ArenaArray {
+  static_assert(std::is_trivially_copyable<T>::value && std::is_trivially_destructible<T>::value,
+                "The values are copied and dropped with their chunks");
+public:
+  explicit ArenaArray(Arena* arena) : arena_(arena) {}
+  ArenaArray(ArenaArray&& other) 
+    : arena_(other.arena_), chunks_(std::move(other.chunks_)), size_(other.size_) {
+    other.chunks_.clear();
+    other.size_ = 0;
+  }
+  ArenaArray& operator=(ArenaArray&& other) {
+    arena_ = other.arena_;
+    chunks_ = std::move(other.chunks_);
+    size_ = other.size_;
+    other.chunks_.clear();
+    other.size_ = 0;
+    return *this;
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return !size_; }
+  T& operator[](size_t index) { return chunks_[index >> kChunkShift][index & kChunkMask]; }
+  const T& operator[](size_t index) const { return chunks_[index >> kChunkShift][index & kChunkMask]; }
+  T& back() { return (*this)[size_ - 1]; }
+  const T& back() const { return (*this)[size_ - 1]; }
+
+  void push_back(const T& value) {
+    if (size_ == chunks_.size() << kChunkShift) {
+      AddChunk();
+    }
+    (*this)[size_++] = value;
+  }
+  void pop_back() { size_--; }
+  void resize(size_t size) {
+    while (size_ < size) {
+      push_back(T());
+    }
+    size_ = size;
+  }
+  void clear() { size_ = 0; }
+
+private:
+  static constexpr size_t kChunkShift = 12;
+  static constexpr size_t kChunkMask = (1 << kChunkShift) - 1;
+  static_assert((sizeof(T) << kChunkShift) <= Arena::kMaxSize, "A chunk fits in an arena block");
+
+  void AddChunk() {
+    if (chunks_.size() == chunks_.capacity()) {
+      arena_->CountHeapAllocation();
+    }
+    chunks_.push_back(static_cast<T*>(arena_->Allocate(sizeof(T) << kChunkShift, alignof(T))));
+  }
+
+  Arena* arena_;
+  std::vector<T*> chunks_;
+  size_t size_ = 0;
+};
@@ -0,0 +1,335 @@
+#include "DebugNames.h"
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include "dwarf32.h"
+#include "DwarfForm.h"
+
+
+struct DebugNames::Table {
+  const unsigned char* end;
+  uint8_t offset_size;
+  uint32_t comp_unit_count;
+  uint32_t local_type_unit_count;
+  uint32_t foreign_type_unit_count;
+  uint32_t bucket_count;
+  uint32_t name_count;
+  const unsigned char* comp_units;
+  const unsigned char* local_type_units;
+  const uint32_t* buckets;
+  const uint32_t* hashes;
+  const unsigned char* string_offsets;
+  const unsigned char* entry_offsets;
+  const unsigned char* abbrevs;
+  const unsigned char* abbrevs_end;
+  const unsigned char* entry_pool;
+};
+
+static uint64_t ReadOffset(const unsigned char* ptr, uint8_t offset_size) {
+  if (offset_size == sizeof(uint64_t)) {
+    return *reinterpret_cast<const uint64_t*>(ptr);
+  }
+  return *reinterpret_cast<const uint32_t*>(ptr);
+}
+
+static uint64_t ReadULEB128(const unsigned char* &ptr, const unsigned char* end) {
+  uint64_t result = 0;
+  unsigned int shift = 0;
+  while (ptr < end) {
+    unsigned char byte = *ptr++;
+    if (shift < 64) {
+      result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    }
+    if (byte < 0x80) {
+      break;
+    }
+    shift += 7;
+  }
+  return result;
+}
+
+// Read a value of an index attribute, they only use constant, reference and
+// flag forms
+static bool ReadIndexValue(Dwarf32::Form form, uint8_t offset_size, const unsigned char* &ptr,
+                           const unsigned char* end, uint64_t& value) {
+  DwarfForm::Descriptor descriptor = DwarfForm::Describe(form);
+  size_t size = 0;
+  switch (descriptor.size) {
+    case DwarfForm::Size::none:
+      if (descriptor.kind != DwarfForm::Kind::flag) {
+        break;
+      }
+      value = 1;
+      return true;
+    case DwarfForm::Size::uleb128:
+      value = ReadULEB128(ptr, end);
+      return true;
+    case DwarfForm::Size::fixed:
+      size = descriptor.fixed_size;
+      break;
+    case DwarfForm::Size::offset:
+    case DwarfForm::Size::ref_addr:
+      size = offset_size;
+      break;
+    default:
+      break;
+  }
+
+  if (!size) {
+    fprintf(stderr, "ERR: Unexpected .debug_names form 0x%x\n", form);
+    return false;
+  }
+
+  if (size > sizeof(value) || ptr + size > end) {
+    return false;
+  }
+  value = DwarfForm::ReadUnsigned(ptr, size);
+  ptr += size;
+  return true;
+}
+
+// static
+uint32_t DebugNames::Hash(const char* name) {
+  uint32_t hash = 5381;
+  for (const unsigned char* c = reinterpret_cast<const unsigned char*>(name); *c; c++) {
+    unsigned char folded = (*c >= 'A' && *c <= 'Z') ? *c - 'A' + 'a' : *c;
+    hash = hash * 33 + folded;
+  }
+  return hash;
+}
+
+bool DebugNames::ReadTable(const unsigned char* ptr, size_t bytes_available, Table& table) const {
+  const unsigned char* begin = ptr;
+  if (bytes_available < sizeof(uint32_t)) {
+    return false;
+  }
+
+  uint64_t unit_length = *reinterpret_cast<const uint32_t*>(ptr);
+  ptr += sizeof(uint32_t);
+  table.offset_size = sizeof(uint32_t);
+  if (unit_length == Dwarf32::kDwarf64Escape) {
+    if (bytes_available < sizeof(uint32_t) + sizeof(uint64_t)) {
+      return false;
+    }
+    unit_length = *reinterpret_cast<const uint64_t*>(ptr);
+    ptr += sizeof(uint64_t);
+    table.offset_size = sizeof(uint64_t);
+  }
+  if (unit_length > bytes_available - (ptr - begin)) {
+    fprintf(stderr, "ERR: Invalid .debug_names length\n");
+    return false;
+  }
+  table.end = ptr + unit_length;
+
+  // version, padding and 7 counts
+  if (ptr + 2 * sizeof(uint16_t) + 7 * sizeof(uint32_t) > table.end) {
+    return false;
+  }
+  uint16_t version = *reinterpret_cast<const uint16_t*>(ptr);
+  if (version != 5) {
+    fprintf(stderr, "ERR: Unsupported .debug_names version %d\n", version);
+    return false;
+  }
+  ptr += 2 * sizeof(uint16_t);
+
+  const uint32_t* counts = reinterpret_cast<const uint32_t*>(ptr);
+  table.comp_unit_count = counts[0];
+  table.local_type_unit_count = counts[1];
+  table.foreign_type_unit_count = counts[2];
+  table.bucket_count = counts[3];
+  table.name_count = counts[4];
+  uint32_t abbrev_table_size = counts[5];
+  uint32_t augmentation_string_size = counts[6];
+  ptr += 7 * sizeof(uint32_t);
+  ptr += (augmentation_string_size + 3) & ~3;    // Padded to 4 bytes
+
+  table.comp_units = ptr;
+  ptr += static_cast<uint64_t>(table.comp_unit_count) * table.offset_size;
+  table.local_type_units = ptr;
+  ptr += static_cast<uint64_t>(table.local_type_unit_count) * table.offset_size;
+  ptr += static_cast<uint64_t>(table.foreign_type_unit_count) * sizeof(uint64_t);
+  table.buckets = reinterpret_cast<const uint32_t*>(ptr);
+  ptr += static_cast<uint64_t>(table.bucket_count) * sizeof(uint32_t);
+  table.hashes = reinterpret_cast<const uint32_t*>(ptr);
+  if (table.bucket_count) {
+    ptr += static_cast<uint64_t>(table.name_count) * sizeof(uint32_t);
+  }
+  table.string_offsets = ptr;
+  ptr += static_cast<uint64_t>(table.name_count) * table.offset_size;
+  table.entry_offsets = ptr;
+  ptr += static_cast<uint64_t>(table.name_count) * table.offset_size;
+  table.abbrevs = ptr;
+  ptr += abbrev_table_size;
+  table.abbrevs_end = ptr;
+  table.entry_pool = ptr;
+
+  if (ptr > table.end || ptr < begin) {
+    fprintf(stderr, "ERR: Truncated .debug_names table\n");
+    return false;
+  }
+  return true;
+}
+
+const char* DebugNames::String(const Table& table, uint64_t offset) const {
+  if (offset >= debug_str_size_) {
+    return nullptr;
+  }
+  return debug_str_ + offset;
+}
+
+bool DebugNames::ReadEntries(const Table& table, uint64_t entry_offset,
+                             std::vector<Entry>& entries) const {
+  struct IndexSpec {
+    uint64_t index;
+    Dwarf32::Form form;
+  };
+  struct Abbrev {
+    uint32_t tag;
+    std::vector<IndexSpec> specs;
+  };
+
+  // The abbreviations are only decoded for the tables containing the name
+  std::map<uint64_t, Abbrev> abbrevs;
+  const unsigned char* ptr = table.abbrevs;
+  while (ptr < table.abbrevs_end) {
+    uint64_t code = ReadULEB128(ptr, table.abbrevs_end);
+    if (!code) {
+      break;
+    }
+    Abbrev& abbrev = abbrevs[code];
+    abbrev.tag = ReadULEB128(ptr, table.abbrevs_end);
+    while (ptr < table.abbrevs_end) {
+      IndexSpec spec;
+      spec.index = ReadULEB128(ptr, table.abbrevs_end);
+      spec.form = static_cast<Dwarf32::Form>(ReadULEB128(ptr, table.abbrevs_end));
+      if (!spec.index && !spec.form) {
+        break;
+      }
+      abbrev.specs.push_back(spec);
+    }
+  }
+
+  // All the entries of a name, until the 0 abbreviation code
+  ptr = table.entry_pool + entry_offset;
+  while (ptr < table.end) {
+    uint64_t code = ReadULEB128(ptr, table.end);
+    if (!code) {
+      break;
+    }
+
+    std::map<uint64_t, Abbrev>::const_iterator it_abbrev = abbrevs.find(code);
+    if (it_abbrev == abbrevs.end()) {
+      fprintf(stderr, "ERR: Unknown .debug_names abbreviation %lu\n", static_cast<unsigned long>(code));
+      return false;
+    }
+
+    // Without DW_IDX_compile_unit, the entry belongs to the single unit
+    uint64_t comp_unit = 0;
+    uint64_t type_unit = UINT64_MAX;
+    uint64_t die_offset = UINT64_MAX;
+    for (const IndexSpec& spec : it_abbrev->second.specs) {
+      uint64_t value = 0;
+      if (!ReadIndexValue(spec.form, table.offset_size, ptr, table.end, value)) {
+        return false;
+      }
+      switch (spec.index) {
+        case Dwarf32::NameIndex::DW_IDX_compile_unit:
+          comp_unit = value;
+          break;
+        case Dwarf32::NameIndex::DW_IDX_type_unit:
+          type_unit = value;
+          break;
+        case Dwarf32::NameIndex::DW_IDX_die_offset:
+          die_offset = value;
+          break;
+        default:
+          break;
+      }
+    }
+
+    if (die_offset == UINT64_MAX) {
+      continue;
+    }
+
+    // The DIE offset is relative to its unit. Only the local type units are
+    // in this file, the foreign ones are in split DWARF objects.
+    Entry entry;
+    entry.tag = it_abbrev->second.tag;
+    if (type_unit != UINT64_MAX) {
+      if (type_unit >= table.local_type_unit_count) {
+        continue;
+      }
+      entry.die_offset = ReadOffset(table.local_type_units + type_unit * table.offset_size, table.offset_size);
+    } else {
+      if (comp_unit >= table.comp_unit_count) {
+        continue;
+      }
+      entry.die_offset = ReadOffset(table.comp_units + comp_unit * table.offset_size, table.offset_size);
+    }
+    entry.die_offset += die_offset;
+    entries.push_back(entry);
+  }
+
+  return true;
+}
+
+bool DebugNames::LookupInTable(const Table& table, const char* name, uint32_t hash,
+                               std::vector<Entry>& entries) const {
+  if (!table.bucket_count) {
+    // No hash table, linear search in the name list
+    for (uint32_t i = 0; i < table.name_count; i++) {
+      const char* str = String(table, ReadOffset(table.string_offsets + i * table.offset_size, table.offset_size));
+      if (str && !strcmp(str, name)) {
+        uint64_t entry_offset = ReadOffset(table.entry_offsets + i * table.offset_size, table.offset_size);
+        return ReadEntries(table, entry_offset, entries);
+      }
+    }
+    return true;
+  }
+
+  // The bucket gives the first name (1-based) of the names sharing the
+  // same hash modulo the bucket count, they are contiguous
+  uint32_t index = table.buckets[hash % table.bucket_count];
+  if (!index) {
+    return true;
+  }
+
+  for (uint32_t i = index - 1; i < table.name_count; i++) {
+    uint32_t name_hash = table.hashes[i];
+    if (name_hash % table.bucket_count != hash % table.bucket_count) {
+      break;
+    }
+    if (name_hash != hash) {
+      continue;
+    }
+
+    const char* str = String(table, ReadOffset(table.string_offsets + i * table.offset_size, table.offset_size));
+    if (!str || strcmp(str, name)) {
+      continue;
+    }
+
+    uint64_t entry_offset = ReadOffset(table.entry_offsets + i * table.offset_size, table.offset_size);
+    return ReadEntries(table, entry_offset, entries);
+  }
+
+  return true;
+}
+
+bool DebugNames::Lookup(const char* name, std::vector<Entry>& entries) const {
+  uint32_t hash = DebugNames::Hash(name);
+
+  const unsigned char* ptr = data_;
+  const unsigned char* end = data_ + size_;
+  while (ptr < end) {
+    Table table;
+    if (!ReadTable(ptr, end - ptr, table)) {
+      return false;
+    }
+    if (!LookupInTable(table, name, hash, entries)) {
+      return false;
+    }
+    ptr = table.end;
+  }
+
+  return true;
+}
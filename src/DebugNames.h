@@ -0,0 +1,39 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+
+// Reader of the DWARF 5 name index (.debug_names). The section can contain
+// several name tables, one per module which was not merged by the linker.
+class DebugNames {
+public:
+  struct Entry {
+    uint64_t die_offset;    // Absolute offset in .debug_info
+    uint32_t tag;
+  };
+
+  DebugNames(const unsigned char* data, size_t size, const char* debug_str, size_t debug_str_size)
+      : data_(data), size_(size), debug_str_(debug_str), debug_str_size_(debug_str_size) {}
+
+  // Append to entries all the DIEs indexed under name
+  bool Lookup(const char* name, std::vector<Entry>& entries) const;
+
+  // DJB hash of the case folded name
+  static uint32_t Hash(const char* name);
+
+
+private:
+  struct Table;
+
+  bool ReadTable(const unsigned char* ptr, size_t bytes_available, Table& table) const;
+  bool LookupInTable(const Table& table, const char* name, uint32_t hash,
+                     std::vector<Entry>& entries) const;
+  bool ReadEntries(const Table& table, uint64_t entry_offset, std::vector<Entry>& entries) const;
+  const char* String(const Table& table, uint64_t offset) const;
+
+  const unsigned char* data_;
+  size_t size_;
+  const char* debug_str_;
+  size_t debug_str_size_;
+};
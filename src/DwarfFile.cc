@@ -1,9 +1,30 @@
 #include "DwarfFile.h"
+#include "AppleAccelTable.h"
+#include "DebugNames.h"
+#include "GdbIndex.h"
+#include "TypeStatistics.h"
 #include "debug.h"
+#include "hash.h"
+#include "simd.h"
+#include <math.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-// TODO: add bounds check!
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 
 void DwarfFile::SetDebugPointers(void* debug_info, size_t debug_info_size, 
@@ -16,9 +37,74 @@ void DwarfFile::SetDebugPointers(void* debug_info, size_t debug_info_size,
   debug_abbrev_size_ = debug_abbrev_size;
   debug_str_ = debug_str;
   debug_str_size_ = debug_str_size;
+  compilation_unit_.clear();
+  units_.clear();
+  units_indexed_ = false;
+  type_signatures_.clear();
+  type_die_signatures_.clear();
+  unit_dies_.clear();
+  unit_dies_indexed_.clear();
   is_loaded_ = true;
 }
 
+bool DwarfFile::SetDebugSection(DebugSection id, void* data, size_t size)
+{
+  if (!IsValidFilePtr(data, size)) {
+    return false;
+  }
+
+  OptionalSection& optional_section = sections_[static_cast<size_t>(id)];
+  optional_section.data = reinterpret_cast<unsigned char*>(data);
+  optional_section.size = size;
+  return true;
+}
+
+bool DwarfFile::MapFile(const std::string& filepath)
+{
+  UnmapFile();
+
+  // The file is mapped rather than read: a lookup only touches the pages of
+  // the DIEs it needs
+  int fd = open(filepath.c_str(), O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "ERR: Failed to open '%s'\n", filepath.c_str());
+    return false;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) < 0 || file_stat.st_size <= 0) {
+    fprintf(stderr, "ERR: Failed to stat '%s'\n", filepath.c_str());
+    close(fd);
+    return false;
+  }
+  filesize_ = file_stat.st_size;
+  DBG_PRINTF("Target file size: 0x%lx\n", filesize_);
+
+  void* mapping = mmap(nullptr, filesize_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    fprintf(stderr, "ERR: Failed to map '%s'\n", filepath.c_str());
+    filesize_ = 0;
+    return false;
+  }
+
+  memfile_ = reinterpret_cast<unsigned char*>(mapping);
+  return true;
+}
+
+void DwarfFile::UnmapFile()
+{
+  if (memfile_) {
+    munmap(memfile_, filesize_);
+    memfile_ = nullptr;
+    filesize_ = 0;
+  }
+  for (OptionalSection& optional_section : sections_) {
+    optional_section = OptionalSection();
+  }
+  is_loaded_ = false;
+}
+
 bool DwarfFile::IsValidFilePtr(void* ptr, size_t size) 
 {
   const void* file_begin = memfile_;
@@ -28,13 +114,16 @@ bool DwarfFile::IsValidFilePtr(void* ptr, size_t size)
   if (cptr + size < cptr) {
     return false;           // Overflow
   }
-  return (cptr >= file_begin) && (cptr + size < file_end);
+  if (!size) {
+    return (cptr >= file_begin) && (cptr < file_end);
+  }
+  return (cptr >= file_begin) && (cptr + size <= file_end); // Can end with the file
 }
 
 // static
-uint32_t DwarfFile::ULEB128(unsigned char* &data, size_t& bytes_available) 
+uint64_t DwarfFile::ULEB128(unsigned char* &data, size_t& bytes_available) 
 {
-  uint32_t result = 0;
+  uint64_t result = 0;
 
   unsigned int shift = 0;
   while (bytes_available > 0) {
@@ -42,332 +131,740 @@ uint32_t DwarfFile::ULEB128(unsigned char* &data, size_t& bytes_available)
     data++;
     bytes_available--;
 
+    if (shift < 64) {
+      result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    }
     if (byte < 0x80) {
-      result += byte << (shift*7);
       return result;
-    } else {
-      byte -= 0x80;
-      result += byte << (shift*7);
     }
 
-    shift++;
+    shift += 7;
   }
 
   return result;
 }
 
 // static
-void DwarfFile::PassData(Dwarf32::Form form, unsigned char* &data, size_t& bytes_available) 
+int64_t DwarfFile::SLEB128(unsigned char* &data, size_t& bytes_available) 
 {
-  uint32_t length = 0;
+  // Shifted unsigned, a bit shifted into the sign bit is undefined
+  uint64_t result = 0;
 
-  switch(form) {
-    // Address
-    case Dwarf32::Form::DW_FORM_addr:
-      data += sizeof(uint64_t);
-      bytes_available -= sizeof(uint64_t);
-      break;
+  unsigned int shift = 0;
+  while (bytes_available > 0) {
+    unsigned char byte = *data;
+    data++;
+    bytes_available--;
 
-    // Block
-    case Dwarf32::Form::DW_FORM_block:
-      length = DwarfFile::ULEB128(data, bytes_available);
-      data += length;
-      bytes_available -= length;
-      break;
-    case Dwarf32::Form::DW_FORM_block1:
-      length = *reinterpret_cast<uint8_t*>(data);
-      data += sizeof(uint8_t) + length;
-      bytes_available -= sizeof(uint8_t) + length;
-      break;
-    case Dwarf32::Form::DW_FORM_block2:
-      length = *reinterpret_cast<uint16_t*>(data);
-      data += sizeof(uint16_t) + length;
-      bytes_available -= sizeof(uint16_t) + length;
-      break;
-    case Dwarf32::Form::DW_FORM_block4:
-      length = *reinterpret_cast<uint32_t*>(data);
-      data += sizeof(uint32_t) + length;
-      bytes_available -= sizeof(uint32_t) + length;
-      break;
+    if (shift < 64) {
+      result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    }
+    shift += 7;
 
-    // Constant
-    case Dwarf32::Form::DW_FORM_data1:
-      data++;
-      bytes_available--;
-      break;
-    case Dwarf32::Form::DW_FORM_data2:
-      data += 2;
-      bytes_available -= 2;
-      break;
-    case Dwarf32::Form::DW_FORM_data4:
-      data += 4;
-      bytes_available -= 4;
-      break;
-    case Dwarf32::Form::DW_FORM_data8:
-      data += 8;
-      bytes_available -= 8;
-      break;
-    case Dwarf32::Form::DW_FORM_sdata:
-      DwarfFile::ULEB128(data, bytes_available);
-      break;
-    case Dwarf32::Form::DW_FORM_udata:
-      DwarfFile::ULEB128(data, bytes_available);
-      break;
+    if (byte < 0x80) {
+      if ((byte & 0x40) && shift < 64) {
+        result |= ~static_cast<uint64_t>(0) << shift; // Sign extend
+      }
+      return static_cast<int64_t>(result);
+    }
+  }
 
-    // Expression or location
-    case Dwarf32::Form::DW_FORM_exprloc:
-      length = DwarfFile::ULEB128(data, bytes_available);
-      data += length;
-      bytes_available -= length;
-      break;
+  return static_cast<int64_t>(result);
+}
 
-    // Line offset
-    case Dwarf32::Form::DW_FORM_sec_offset:
-      data += 4;
-      bytes_available -= 4;
-      break;
+// static
+size_t DwarfFile::InlineStringSize(const unsigned char* data, size_t bytes_available)
+{
+  size_t length = FindNulByte(data, bytes_available);
+  if (length == bytes_available) {
+    return 0;          // Unterminated string
+  }
+  return length + 1; // Include the NUL byte
+}
 
-    // Flag
-    case Dwarf32::Form::DW_FORM_flag:
-      data++;
-      bytes_available--;
-      break;
-    case Dwarf32::Form::DW_FORM_flag_present:
-      break;
+template <typename Decoder>
+bool DwarfFile::DecodeWithUnitFormat(const Unit& unit, Decoder decode)
+{
+  bool dwarf2 = (unit.version == 2);
+  if (unit.offset_size == sizeof(uint64_t)) {   // DWARF64 started with DWARF 3
+    if (unit.address_size == sizeof(uint64_t)) {
+      return decode(DwarfForm::UnitFormat<uint64_t, 8, false>());
+    }
+    if (unit.address_size == sizeof(uint32_t)) {
+      return decode(DwarfForm::UnitFormat<uint64_t, 4, false>());
+    }
+  } else if (unit.address_size == sizeof(uint64_t)) {
+    return dwarf2 ? decode(DwarfForm::UnitFormat<uint32_t, 8, true>()) : 
+                    decode(DwarfForm::UnitFormat<uint32_t, 8, false>());
+  } else if (unit.address_size == sizeof(uint32_t)) {
+    return dwarf2 ? decode(DwarfForm::UnitFormat<uint32_t, 4, true>()) : 
+                    decode(DwarfForm::UnitFormat<uint32_t, 4, false>());
+  }
 
-    // Reference
-    case Dwarf32::Form::DW_FORM_ref1:
-      data++;
-      bytes_available--;
+  fprintf(stderr, "ERR: Unsupported address size %d\n", unit.address_size);
+  return false;
+}
+
+template <typename Format>
+DwarfFile::FormValue DwarfFile::ReadForm(const AttributeSpec& spec, unsigned char* &info, size_t& bytes_available) 
+{
+  DwarfForm::Descriptor form = DwarfForm::Describe(spec.form);
+  FormValue form_value = {0, info, form.kind};
+  uint64_t size = 0;
+  bool variable_size = false;   // The fixed size parts are checked per DIE
+
+  switch (form.size) {
+    case DwarfForm::Size::fixed:
+      size = form.fixed_size;
+      form_value.value = DwarfForm::ReadUnsigned(info, form.fixed_size);
       break;
-    case Dwarf32::Form::DW_FORM_ref2:
-      data += 2;
-      bytes_available -= 2;
+    case DwarfForm::Size::none:
+      if (form.kind == DwarfForm::Kind::flag) {
+        form_value.value = 1;                   // DW_FORM_flag_present
+      } else {
+        form_value.value = spec.implicit_const; // Stored in the abbreviation
+      }
       break;
-    case Dwarf32::Form::DW_FORM_ref4:
-      data += 4;
-      bytes_available -= 4;
+    case DwarfForm::Size::offset:
+      size = sizeof(typename Format::Offset);
+      form_value.value = *reinterpret_cast<typename Format::Offset*>(info);
       break;
-    case Dwarf32::Form::DW_FORM_ref8:
-      data += 8;
-      bytes_available -= 8;
+    case DwarfForm::Size::address:
+      size = Format::kAddressSize;
+      form_value.value = DwarfForm::ReadUnsigned(info, Format::kAddressSize);
       break;
-    case Dwarf32::Form::DW_FORM_ref_udata:
-      DwarfFile::ULEB128(data, bytes_available);
+    case DwarfForm::Size::ref_addr:
+      size = Format::kRefAddrSize;
+      form_value.value = DwarfForm::ReadUnsigned(info, Format::kRefAddrSize);
       break;
-    case Dwarf32::Form::DW_FORM_ref_addr:
-      data += 4;
-      bytes_available -= 4;
+    case DwarfForm::Size::uleb128:
+      form_value.value = DwarfFile::ULEB128(info, bytes_available);
+      variable_size = true;
       break;
-    case Dwarf32::Form::DW_FORM_ref_sig8:
-      data += 8;
-      bytes_available -= 8;
+    case DwarfForm::Size::sleb128:
+      form_value.value = DwarfFile::SLEB128(info, bytes_available);
+      variable_size = true;
       break;
 
-    // String
-    case Dwarf32::Form::DW_FORM_strp:
-      data += 4;
-      bytes_available -= 4;
+    // The value of a block is its length
+    case DwarfForm::Size::block:
+      form_value.value = DwarfFile::ULEB128(info, bytes_available);
+      form_value.data = info;
+      size = form_value.value;
+      variable_size = true;
       break;
-    case Dwarf32::Form::DW_FORM_string:
-      while (*data) {
-          data++;
-          bytes_available--;
-      }
-      data++;
-      bytes_available--;
+    case DwarfForm::Size::block1:
+    case DwarfForm::Size::block2:
+    case DwarfForm::Size::block4: {
+      uint8_t length_size = (form.size == DwarfForm::Size::block1) ? 1 : 
+                            (form.size == DwarfForm::Size::block2) ? 2 : 4;
+      form_value.value = DwarfForm::ReadUnsigned(info, length_size);
+      info += length_size;
+      bytes_available -= length_size;
+      form_value.data = info;
+      size = form_value.value;
+      variable_size = true;
       break;
+    }
 
-    default:
-      fprintf(stderr, "ERR: Unpexpected form type 0x%x\n", form);
+    case DwarfForm::Size::string:
+      size = DwarfFile::InlineStringSize(info, bytes_available);
+      if (!size) {
+        SetMalformed(info, bytes_available);
+        return form_value;
+      }
+      variable_size = true;
       break;
+
+    // The form is given in the data itself, its fixed part wasn't checked
+    case DwarfForm::Size::indirect: {
+      AttributeSpec indirect_spec = spec;
+      indirect_spec.form = static_cast<Dwarf32::Form>(DwarfFile::ULEB128(info, bytes_available));
+      uint64_t fixed_part = Format::FixedPartSize(DwarfForm::Describe(indirect_spec.form));
+      if (fixed_part + spec.fixed_size_after > bytes_available) {
+        SetMalformed(info, bytes_available);
+        return form_value;
+      }
+      return ReadForm<Format>(indirect_spec, info, bytes_available);
+    }
+
+    case DwarfForm::Size::invalid:
+      fprintf(stderr, "ERR: Unexpected form type 0x%x\n", spec.form);
+      SetMalformed(info, bytes_available);
+      return form_value;
+  }
+
+  // The variable part and the fixed parts of the next attributes must be in
+  // the unit
+  if (variable_size && (spec.fixed_size_after > bytes_available || 
+                        size > bytes_available - spec.fixed_size_after)) {
+    SetMalformed(info, bytes_available);
+    return form_value;
   }
+
+  info += size;
+  bytes_available -= size;
+  return form_value;
 }
 
-uint64_t DwarfFile::FormDataValue(Dwarf32::Form form, unsigned char* &info, size_t& bytes_available) 
+void DwarfFile::SetMalformed(unsigned char* &info, size_t& bytes_available)
 {
-  uint64_t value = 0;
+  // The rest of the DIE is read from zeros, then the unit is skipped
+  malformed_ = true;
+  info = malformed_sink_.data();
+  bytes_available = malformed_sink_.size();
+}
 
-  switch(form) {
-    case Dwarf32::Form::DW_FORM_data1:
-    case Dwarf32::Form::DW_FORM_ref1:
-    case Dwarf32::Form::DW_FORM_flag_present:
-      value = *reinterpret_cast<uint8_t*>(info);
-      info++;
-      bytes_available--;
-      break;
-    case Dwarf32::Form::DW_FORM_data2:
-    case Dwarf32::Form::DW_FORM_ref2:
-      value = *reinterpret_cast<uint16_t*>(info);
-      info += 2;
-      bytes_available -= 2;
-      break;
-    case Dwarf32::Form::DW_FORM_data4:
-    case Dwarf32::Form::DW_FORM_ref4:
-    case Dwarf32::Form::DW_FORM_ref_addr:
-    case Dwarf32::Form::DW_FORM_sec_offset:
-      value = *reinterpret_cast<uint32_t*>(info);
-      info += 4;
-      bytes_available -= 4;
-      break;
-    case Dwarf32::Form::DW_FORM_data8:
-    case Dwarf32::Form::DW_FORM_ref8:
-    case Dwarf32::Form::DW_FORM_ref_sig8:
-      value = *reinterpret_cast<uint64_t*>(info);
-      info += 8;
-      bytes_available -= 8;
-      break;
-    case Dwarf32::Form::DW_FORM_sdata:
-    case Dwarf32::Form::DW_FORM_udata:
-    case Dwarf32::Form::DW_FORM_ref_udata:
-    case Dwarf32::Form::DW_FORM_indirect:
-      value = DwarfFile::ULEB128(info, bytes_available);
-      break;
-    case Dwarf32::Form::DW_FORM_exprloc:
-      value = DwarfFile::ULEB128(info, bytes_available);
-      info += value;
-      bytes_available -= value;
-      break;
+template <typename Format>
+void DwarfFile::PassData(const AttributeSpec& spec, unsigned char* &data, size_t& bytes_available) 
+{
+  ReadForm<Format>(spec, data, bytes_available);
+}
+
+template <typename Format>
+uint64_t DwarfFile::FormDataValue(const AttributeSpec& spec, unsigned char* &info, size_t& bytes_available) 
+{
+  FormValue form_value = ReadForm<Format>(spec, info, bytes_available);
+  if (form_value.kind == DwarfForm::Kind::address_index) {
+    return IndexedAddress<Format>(form_value.value);
+  }
+  return form_value.value;
+}
+
+template <typename Format>
+uint64_t DwarfFile::FormReferenceValue(const AttributeSpec& spec, unsigned char* &info, size_t& bytes_available) 
+{
+  // The id of the DIE referenced in the sections parsed, 0 for the type units
+  // and the supplementary files
+  FormValue form_value = ReadForm<Format>(spec, info, bytes_available);
+  switch (form_value.kind) {
+    case DwarfForm::Kind::reference:
+      return unit_.offset + form_value.value;
+    case DwarfForm::Kind::global_reference:
+      return form_value.value;
     default:
-      fprintf(stderr, "ERR: Unexpected form data 0x%x\n", form);
-      exit(1);
+      return 0;
   }
+}
 
-  return value;
-};
+template <typename Format>
+char* DwarfFile::FormStringValue(const AttributeSpec& spec, unsigned char* &info, size_t& bytes_available) 
+{
+  return StringValue<Format>(spec, ReadForm<Format>(spec, info, bytes_available));
+}
 
-char* DwarfFile::FormStringValue(Dwarf32::Form form, unsigned char* &info, size_t& bytes_available) 
+template <typename Format>
+char* DwarfFile::StringValue(const AttributeSpec& spec, const FormValue& form_value) 
 {
-  char* str = nullptr;
-  uint32_t str_pos = 0;
+  const OptionalSection& line_str = section(DebugSection::line_str);
 
-  switch(form) {
-    case Dwarf32::Form::DW_FORM_strp:
-      str_pos = *reinterpret_cast<uint32_t*>(info);
-      info += sizeof(str_pos);
-      bytes_available -= sizeof(str_pos);
-      str = reinterpret_cast<char*>(debug_str_) + str_pos;
-      break;
-    case Dwarf32::Form::DW_FORM_string:
-      str = reinterpret_cast<char*>(info);
-      while (*info) {
-          info++;
-          bytes_available--;
-      }
-      info++;
-      bytes_available--;
-      break;
+  switch (form_value.kind) {
+    case DwarfForm::Kind::string_offset:
+      if (form_value.value < debug_str_size_) {
+        return reinterpret_cast<char*>(debug_str_) + form_value.value;
+      }
+      return nullptr;
+    case DwarfForm::Kind::line_string_offset:
+      if (line_str.data && form_value.value < line_str.size) {
+        return reinterpret_cast<char*>(line_str.data) + form_value.value;
+      }
+      return nullptr;
+    case DwarfForm::Kind::string_index:
+      return IndexedString<Format>(form_value.value);
+    case DwarfForm::Kind::inline_string:
+      return reinterpret_cast<char*>(form_value.data);
+    case DwarfForm::Kind::supplementary:
+      // The string is in a supplementary object file that we don't load
+      return nullptr;
     default:
-      fprintf(stderr, "ERR: Unexpected form string 0x%x\n", form);
+      fprintf(stderr, "ERR: Unexpected form string 0x%x\n", spec.form);
+      return nullptr;
+  }
+}
+
+template <typename Format>
+char* DwarfFile::IndexedString(uint64_t index)
+{
+  // The unit's contribution to .debug_str_offsets is an array of offsets in
+  // .debug_str, starting at DW_AT_str_offsets_base
+  typedef typename Format::Offset Offset;
+  const OptionalSection& str_offsets = section(DebugSection::str_offsets);
+  uint64_t pos = unit_.str_offsets_base + index * sizeof(Offset);
+  if (!str_offsets.data || pos + sizeof(Offset) > str_offsets.size) {
+    fprintf(stderr, "ERR: String index outside of .debug_str_offsets\n");
+    return nullptr;
+  }
+
+  uint64_t str_pos = *reinterpret_cast<Offset*>(str_offsets.data + pos);
+  if (str_pos >= debug_str_size_) {
+    return nullptr;
+  }
+  return reinterpret_cast<char*>(debug_str_) + str_pos;
+}
+
+template <typename Format>
+uint64_t DwarfFile::IndexedAddress(uint64_t index)
+{
+  const OptionalSection& addr = section(DebugSection::addr);
+  uint64_t pos = unit_.addr_base + index * Format::kAddressSize;
+  if (!addr.data || pos + Format::kAddressSize > addr.size) {
+    return 0;
+  }
+  return DwarfForm::ReadUnsigned(addr.data + pos, Format::kAddressSize);
+}
+
+bool DwarfFile::ReadUnitHeader(unsigned char* info, size_t info_bytes, Unit& unit)
+{
+  unit.type_signature = 0;
+  unit.type_offset = 0;
+  unit.end = nullptr;
+  if (info_bytes < sizeof(uint32_t)) {
+    fprintf(stderr, "ERR: Truncated unit header\n");
+    return false;
+  }
+
+  uint32_t unit_length = *reinterpret_cast<uint32_t*>(info);
+  if (unit_length == Dwarf32::kDwarf64Escape) {
+    return ReadUnitHeaderFields<Dwarf32::CompilationUnitHdr64, Dwarf32::CompilationUnitHdr5_64>(
+        info, info_bytes, unit);
+  }
+  if (unit_length >= 0xfffffff0) {
+    fprintf(stderr, "ERR: Reserved unit length 0x%x\n", unit_length);
+    return false;
+  }
+  return ReadUnitHeaderFields<Dwarf32::CompilationUnitHdr, Dwarf32::CompilationUnitHdr5>(
+      info, info_bytes, unit);
+}
+
+template <typename Hdr, typename Hdr5>
+bool DwarfFile::ReadUnitHeaderFields(unsigned char* info, size_t info_bytes, Unit& unit)
+{
+  if (info_bytes < sizeof(Hdr)) {
+    fprintf(stderr, "ERR: Truncated unit header\n");
+    return false;
+  }
+
+  // The unit length doesn't count the length field itself
+  Hdr* unit_hdr = reinterpret_cast<Hdr*>(info);
+  if (unit_hdr->unit_length > info_bytes - offsetof(Hdr, version)) {
+    fprintf(stderr, "ERR: Invalid unit length\n");
+    return false;
+  }
+  unit.begin = info;
+  unit.end = info + offsetof(Hdr, version) + unit_hdr->unit_length;
+  unit.version = unit_hdr->version;
+  unit.offset_size = sizeof(unit_hdr->abbrev_offset);
+  unit.str_offsets_base = 0;
+  unit.addr_base = 0;
+
+  if (unit.version < 2 || unit.version > 5) {
+    fprintf(stderr, "ERR: Unsupported DWARF version %d\n", unit.version);
+    return false;
+  }
+
+  // The type units have the signature and the offset of the type DIE after
+  // the common header
+  unsigned char* type_fields = nullptr;
+
+  if (unit.version < 5) {
+    unit.unit_type = Dwarf32::UnitType::DW_UT_compile;
+    unit.address_size = unit_hdr->address_size;
+    unit.abbrev_offset = unit_hdr->abbrev_offset;
+    unit.dies = info + sizeof(Hdr);
+    if (unit.section == section(DebugSection::types).data) {
+      unit.unit_type = Dwarf32::UnitType::DW_UT_type;
+      type_fields = unit.dies;
+      unit.dies += sizeof(uint64_t) + unit.offset_size;
+    }
+  } else {
+    if (info_bytes < sizeof(Hdr5)) {
+      fprintf(stderr, "ERR: Truncated unit header\n");
+      return false;
+    }
+    Hdr5* unit_hdr5 = reinterpret_cast<Hdr5*>(info);
+    unit.unit_type = unit_hdr5->unit_type;
+    unit.address_size = unit_hdr5->address_size;
+    unit.abbrev_offset = unit_hdr5->abbrev_offset;
+    unit.dies = info + sizeof(Hdr5);
+
+    switch (unit.unit_type) {
+      case Dwarf32::UnitType::DW_UT_skeleton:
+      case Dwarf32::UnitType::DW_UT_split_compile:
+        unit.dies += sizeof(uint64_t);                          // dwo_id
+        break;
+      case Dwarf32::UnitType::DW_UT_type:
+      case Dwarf32::UnitType::DW_UT_split_type:
+        type_fields = unit.dies;
+        unit.dies += sizeof(uint64_t) + unit.offset_size;       // type_signature, type_offset
+        break;
+      default:
+        break;
+    }
+
+    // Default to the first contribution, after its header (length and
+    // version), when the unit has no DW_AT_str_offsets_base
+    unit.str_offsets_base = 2 * unit.offset_size;
+  }
+
+  if (unit.dies > unit.end) {
+    fprintf(stderr, "ERR: Invalid unit length\n");
+    return false;
+  }
+
+  if (type_fields) {
+    unit.type_signature = *reinterpret_cast<uint64_t*>(type_fields);
+    unit.type_offset = (unit.offset_size == sizeof(uint64_t)) ? 
+        *reinterpret_cast<uint64_t*>(type_fields + sizeof(uint64_t)) : 
+        *reinterpret_cast<uint32_t*>(type_fields + sizeof(uint64_t));
+  }
+  return true;
+}
+
+template <typename Format>
+void DwarfFile::ReadUnitBases(unsigned char* info, size_t info_bytes)
+{
+  // The bases are attributes of the root DIE, but they can be listed after
+  // attributes using them (DW_AT_name in DW_FORM_strx). Resolve them first.
+  uint64_t abbrev_num = DwarfFile::ULEB128(info, info_bytes);
+  CompilationUnit::iterator it_section = compilation_unit_.find(abbrev_num);
+  if (it_section == compilation_unit_.end() || it_section->second.fixed_size > info_bytes) {
+    return;
+  }
+
+  for (const AttributeSpec& spec : it_section->second.attributes) {
+    switch (spec.attribute) {
+      case Dwarf32::Attribute::DW_AT_str_offsets_base:
+        unit_.str_offsets_base = FormDataValue<Format>(spec, info, info_bytes);
+        break;
+      case Dwarf32::Attribute::DW_AT_addr_base:
+        unit_.addr_base = FormDataValue<Format>(spec, info, info_bytes);
+        break;
+      default:
+        DwarfFile::PassData<Format>(spec, info, info_bytes);
+        break;
+    }
+  }
+}
+
+bool DwarfFile::ReadAbbrev(const Unit& unit, unsigned char* &abbrev, size_t& abbrev_bytes, 
+                           TagSection& section)
+{
+  // The filters are not applied, all the attributes are skipped
+  uint8_t ref_addr_size = (unit.version == 2) ? unit.address_size : unit.offset_size;
+  section.attributes.clear();
+  section.number = DwarfFile::ULEB128(abbrev, abbrev_bytes);
+  if (section.number == 0) {
+    // End of the tags list
+    return false;
+  }
+
+  // DBG_PRINTF(".abbrev+%lx\t Tag Number %d\n", 
+  //     abbrev - reinterpret_cast<unsigned char*>(debug_abbrev_), section.number);
+
+  section.type = static_cast<Dwarf32::Tag>(DwarfFile::ULEB128(abbrev, abbrev_bytes));
+  if (!abbrev_bytes) {
+    return false;
+  }
+  section.has_children = *abbrev;
+  abbrev++;
+  abbrev_bytes--;
+
+  while (abbrev_bytes > 0) { // For all attributes
+    AttributeSpec spec;
+    spec.attribute = static_cast<Dwarf32::Attribute>(DwarfFile::ULEB128(abbrev, abbrev_bytes));
+    spec.form = static_cast<Dwarf32::Form>(DwarfFile::ULEB128(abbrev, abbrev_bytes));
+    spec.implicit_const = 0;
+    spec.fixed_size_after = 0;
+    spec.logged = false;
+    spec.output = false;
+    spec.skip_count = 0;
+    spec.skip_size = 0;
+    if (!spec.attribute && !spec.form) {
+      // End of the attribute list
       break;
+    }
+    if (spec.form == Dwarf32::Form::DW_FORM_implicit_const) {
+      spec.implicit_const = DwarfFile::SLEB128(abbrev, abbrev_bytes);
+    }
+    section.attributes.push_back(spec);
   }
 
-  return str;
-};
+  // Size of the fixed parts of the attributes, checked once per DIE. The
+  // variable size attributes check the fixed parts after them.
+  section.fixed_size = 0;
+  section.fixed_size_only = true;
+  for (size_t i = section.attributes.size(); i-- > 0;) {
+    DwarfForm::Descriptor descriptor = DwarfForm::Describe(section.attributes[i].form);
+    section.attributes[i].fixed_size_after = section.fixed_size;
+    section.fixed_size += DwarfForm::FixedPartSize(descriptor, unit.offset_size, unit.address_size, 
+                                                   ref_addr_size);
+    section.fixed_size_only &= DwarfForm::IsFixedSize(descriptor);
+  }
+  section.wanted = false;
+  section.named_type = false;
+  section.declarable = false;
+  return true;
+}
 
-bool DwarfFile::LoadAbbrevTags(uint32_t abbrev_offset) 
+bool DwarfFile::LoadAbbrevTags(const Unit& unit) 
 {
-  // TODO: for optimization, if we have previously parsed the same abbrev_offset, don't parse it again and just
-  //       don't clear compilation_unit_.
+  // Units of the same module often share their abbreviations. The fixed
+  // sizes depend on the unit format.
+  uint64_t abbrev_offset = unit.abbrev_offset;
+  uint32_t format = unit.offset_size | (unit.address_size << 8) | ((unit.version == 2) << 16);
+  if (!compilation_unit_.empty() && compilation_unit_offset_ == abbrev_offset && 
+      compilation_unit_format_ == format) {
+    return true;
+  }
   compilation_unit_.clear();
+  compilation_unit_offset_ = abbrev_offset;
+  compilation_unit_format_ = format;
+  uint8_t ref_addr_size = (unit.version == 2) ? unit.address_size : unit.offset_size;
+  size_t sink_size = 0;
 
-  unsigned char* abbrev = reinterpret_cast<unsigned char*>(debug_abbrev_) + abbrev_offset;
+  if (abbrev_offset >= debug_abbrev_size_) {
+    fprintf(stderr, "ERR: Abbreviation offset outside of .debug_abbrev\n");
+    return false;
+  }
+
+  unsigned char* abbrev_begin = reinterpret_cast<unsigned char*>(debug_abbrev_) + abbrev_offset;
+  unsigned char* abbrev = abbrev_begin;
   size_t abbrev_bytes = debug_abbrev_size_ - abbrev_offset;
 
   // For all compilation tags
-  while (abbrev_bytes > 0) {
-    struct TagSection section;
-    section.number = DwarfFile::ULEB128(abbrev, abbrev_bytes);
-    if (section.number == 0) {
-      // End of the tags list
-      break;
+  struct TagSection section;
+  while (ReadAbbrev(unit, abbrev, abbrev_bytes, section)) {
+    // The filters are applied here: the attributes which are not decoded are
+    // skipped by size, the consecutive ones of fixed size at once. Nothing is
+    // decoded in the DIEs of the unwanted tags.
+    section.wanted = tag_filter_.empty() || tag_filter_.count(section.type);
+    section.named_type = section.wanted && TreeBuilder::IsNamedType(TagElementType(section.type));
+    section.declarable = section.named_type && IsScopeTag(section.type);
+    for (size_t i = section.attributes.size(); i-- > 0;) {
+      AttributeSpec& spec = section.attributes[i];
+      spec.output = section.wanted && IsLoggedAttribute(spec.attribute) && 
+                    (attribute_filter_.empty() || attribute_filter_.count(spec.attribute));
+      // The names of the scopes and the declarations of the types are always
+      // read to merge the declarations
+      spec.logged = spec.output || 
+          (IsScopeTag(section.type) && spec.attribute == Dwarf32::Attribute::DW_AT_name) || 
+          (section.declarable && (spec.attribute == Dwarf32::Attribute::DW_AT_declaration || 
+                                  spec.attribute == Dwarf32::Attribute::DW_AT_specification ||
+                                  spec.attribute == Dwarf32::Attribute::DW_AT_signature));
+      spec.skip_count = 0;
+      spec.skip_size = 0;
+      DwarfForm::Descriptor descriptor = DwarfForm::Describe(spec.form);
+      if (!spec.logged && DwarfForm::IsFixedSize(descriptor)) {
+        spec.skip_count = 1;
+        spec.skip_size = DwarfForm::FixedPartSize(descriptor, unit.offset_size, unit.address_size, 
+                                                  ref_addr_size);
+        if (i + 1 < section.attributes.size()) {
+          spec.skip_count += section.attributes[i + 1].skip_count;
+          spec.skip_size += section.attributes[i + 1].skip_size;
+        }
+      }
     }
-
-    // DBG_PRINTF(".abbrev+%lx\t Tag Number %d\n", 
-    //     abbrev - reinterpret_cast<unsigned char*>(debug_abbrev_), section.number);
-
-    section.type = static_cast<Dwarf32::Tag>(DwarfFile::ULEB128(abbrev, abbrev_bytes));
-    section.has_children = *abbrev;
-    abbrev++;
-    abbrev_bytes--;
-    section.ptr = abbrev;
+    sink_size = std::max(sink_size, section.fixed_size + section.attributes.size() + 1);
 
     if (compilation_unit_.find(section.number) != compilation_unit_.end()) {
       fprintf(stderr, "ERR: Section number %d already exists\n", section.number);
       compilation_unit_.clear();
       return false;
     }
-    compilation_unit_[section.number] = section;
+    compilation_unit_[section.number] = std::move(section);
+  }
 
-    while (abbrev_bytes > 0 && abbrev[0]) { // For all attributes
-      abbrev++;
-    }
-    abbrev += 2;
-    abbrev_bytes -= 2;
+  // Enough zeros to read the rest of any malformed DIE
+  if (malformed_sink_.size() < sink_size) {
+    malformed_sink_.resize(sink_size);
   }
+  compilation_unit_hash_ = HashBytes(0, abbrev_begin, abbrev - abbrev_begin);
 
   // DBG_PRINTF("compilation_unit_.size()  = %lu\n", compilation_unit_.size());
   return true;
 }
 
-#define CASE_REGISTER_NEW_TAG(tag_type, element_type)                                       \
-  case Dwarf32::Tag::tag_type:                                                              \
-    tree_builder_.AddElement(TreeBuilder::ElementType::element_type, tag_id, has_children); \
-    break;
+#define CASE_TAG_ELEMENT_TYPE(tag_type, element_type)  \
+  case Dwarf32::Tag::tag_type:                         \
+    return TreeBuilder::ElementType::element_type;
 
-void DwarfFile::RegisterNewTag(Dwarf32::Tag tag, uint64_t tag_id, bool has_children) {
+// static
+TreeBuilder::ElementType DwarfFile::TagElementType(Dwarf32::Tag tag) {
+  switch (tag) {
+    CASE_TAG_ELEMENT_TYPE(DW_TAG_array_type, array_type)
+    CASE_TAG_ELEMENT_TYPE(DW_TAG_class_type, class_type)
+    CASE_TAG_ELEMENT_TYPE(DW_TAG_enumeration_type, enumerator_type)
+    CASE_TAG_ELEMENT_TYPE(DW_TAG_member, member)
+    CASE_TAG_ELEMENT_TYPE(DW_TAG_pointer_type, pointer_type)
+    CASE_TAG_ELEMENT_TYPE(DW_TAG_structure_type, structure_type)
+    CASE_TAG_ELEMENT_TYPE(DW_TAG_typedef, typedef2)
+    CASE_TAG_ELEMENT_TYPE(DW_TAG_union_type, union_type)
+    CASE_TAG_ELEMENT_TYPE(DW_TAG_inheritance, inheritance)
+    CASE_TAG_ELEMENT_TYPE(DW_TAG_subrange_type, subrange_type)
+    CASE_TAG_ELEMENT_TYPE(DW_TAG_base_type, base_type)
+    CASE_TAG_ELEMENT_TYPE(DW_TAG_const_type, const_type)
+    default:
+      return TreeBuilder::ElementType::none;
+  }
+}
+
+// static
+bool DwarfFile::IsLoggedAttribute(Dwarf32::Attribute attribute) {
+  // The attributes decoded by LogDwarfInfo
+  switch (attribute) {
+    case Dwarf32::Attribute::DW_AT_name:
+    case Dwarf32::Attribute::DW_AT_linkage_name:
+    case Dwarf32::Attribute::DW_AT_byte_size:
+    case Dwarf32::Attribute::DW_AT_data_member_location:
+    case Dwarf32::Attribute::DW_AT_type:
+    case Dwarf32::Attribute::DW_AT_count:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// static
+bool DwarfFile::IsScopeTag(Dwarf32::Tag tag) {
+  // The tags giving their name to the qualified names of their children
+  switch (tag) {
+    case Dwarf32::Tag::DW_TAG_namespace:
+    case Dwarf32::Tag::DW_TAG_class_type:
+    case Dwarf32::Tag::DW_TAG_structure_type:
+    case Dwarf32::Tag::DW_TAG_union_type:
+    case Dwarf32::Tag::DW_TAG_enumeration_type:
+      return true;
+    default:
+      return false;
+  }
+}
+
+uint32_t DwarfFile::ChildrenScope(Dwarf32::Tag tag, uint32_t scope) {
   switch (tag) {
-    CASE_REGISTER_NEW_TAG(DW_TAG_array_type, array_type)
-    CASE_REGISTER_NEW_TAG(DW_TAG_class_type, class_type)
-    CASE_REGISTER_NEW_TAG(DW_TAG_enumeration_type, enumerator_type)
-    CASE_REGISTER_NEW_TAG(DW_TAG_member, member)
-    CASE_REGISTER_NEW_TAG(DW_TAG_pointer_type, pointer_type)
-    CASE_REGISTER_NEW_TAG(DW_TAG_structure_type, structure_type)
-    CASE_REGISTER_NEW_TAG(DW_TAG_typedef, typedef2)
-    CASE_REGISTER_NEW_TAG(DW_TAG_union_type, union_type)
-    CASE_REGISTER_NEW_TAG(DW_TAG_inheritance, inheritance)
-    CASE_REGISTER_NEW_TAG(DW_TAG_subrange_type, subrange_type)
-    CASE_REGISTER_NEW_TAG(DW_TAG_base_type, base_type)
-    CASE_REGISTER_NEW_TAG(DW_TAG_const_type, const_type)
+    case Dwarf32::Tag::DW_TAG_compile_uniintt:
+    case Dwarf32::Tag::DW_TAG_partial_unit:
+    case Dwarf32::Tag::DW_TAG_type_unit:
+    case Dwarf32::Tag::DW_TAG_skeleton_unit:
+      return TreeBuilder::kGlobalScope;
+    case Dwarf32::Tag::DW_TAG_namespace:
+      if (scope == TreeBuilder::kLocalScope) {
+        return scope;
+      }
+      // An anonymous namespace is only visible in its unit
+      return tree_builder_.InternScope(scope, die_name_, die_name_ ? 0 : unit_.offset);
+    case Dwarf32::Tag::DW_TAG_class_type:
+    case Dwarf32::Tag::DW_TAG_structure_type:
+    case Dwarf32::Tag::DW_TAG_union_type:
+    case Dwarf32::Tag::DW_TAG_enumeration_type:
+      if (scope == TreeBuilder::kLocalScope || !die_name_) {
+        return TreeBuilder::kLocalScope;    // Member of an anonymous type
+      }
+      return tree_builder_.InternScope(scope, die_name_, 0);
     default:
-      tree_builder_.AddElement(TreeBuilder::ElementType::none, 0, has_children);
+      return TreeBuilder::kLocalScope;      // Function or block
+  }
+}
+
+const DwarfFile::Declaration* DwarfFile::FindDeclaration(uint64_t die_offset) const
+{
+  std::vector<Declaration>::const_iterator it_declaration = std::lower_bound(
+      unit_declarations_.begin(), unit_declarations_.end(), die_offset, 
+      [](const Declaration& declaration, uint64_t offset) { return declaration.offset < offset; });
+  if (it_declaration == unit_declarations_.end() || it_declaration->offset != die_offset) {
+    return nullptr;
+  }
+  return &*it_declaration;
+}
+
+void DwarfFile::RegisterNewTag(Dwarf32::Tag tag, uint64_t tag_id, bool has_children) {
+  TreeBuilder::ElementType element_type = TagElementType(tag);
+  if (element_type == TreeBuilder::ElementType::none) {
+    tag_id = 0;
   }
+  tree_builder_.AddElement(element_type, tag_id, has_children);
 }
 
+template <typename Format>
 bool DwarfFile::LogDwarfInfo(
-    Dwarf32::Tag tag, Dwarf32::Attribute attribute,  uint64_t tag_id, Dwarf32::Form form, unsigned char* &info, 
-    size_t& info_bytes, void* unit_base) 
+    Dwarf32::Tag tag, const AttributeSpec& spec, uint64_t tag_id, unsigned char* &info, size_t& info_bytes) 
 {
-  switch(attribute) {
+  switch(spec.attribute) {
     // Name
     case Dwarf32::Attribute::DW_AT_name:
     case Dwarf32::Attribute::DW_AT_linkage_name: {
-      char* name = FormStringValue(form, info, info_bytes);
-      tree_builder_.SetElementName(name);
+      char* name = FormStringValue<Format>(spec, info, info_bytes);
+      if (spec.attribute == Dwarf32::Attribute::DW_AT_name) {
+        die_name_ = name;
+      }
+      if (spec.output) {
+        tree_builder_.SetElementName(name);
+      }
+      return true;
+    }
+
+    // Declaration of a type defined elsewhere
+    case Dwarf32::Attribute::DW_AT_declaration:
+      die_declaration_ = FormDataValue<Format>(spec, info, info_bytes) != 0;
+      return true;
+
+    // Definition of a declaration, outside of its scope
+    case Dwarf32::Attribute::DW_AT_specification:
+      die_specification_ = FormReferenceValue<Format>(spec, info, info_bytes);
+      return true;
+
+    // Declaration of the type DIE of a type unit
+    case Dwarf32::Attribute::DW_AT_signature: {
+      if (DwarfForm::Describe(spec.form).kind != DwarfForm::Kind::signature) {
+        return false;
+      }
+      std::unordered_map<uint64_t, uint64_t>::const_iterator it_type = 
+          type_signatures_.find(FormDataValue<Format>(spec, info, info_bytes));
+      die_signature_ = (it_type != type_signatures_.end()) ? it_type->second : 0;
+      die_declaration_ = true;    // Even without DW_AT_declaration
       return true;
     }
 
     // Size
     case Dwarf32::Attribute::DW_AT_byte_size: {
-      uint64_t byte_size = FormDataValue(form, info, info_bytes);
+      uint64_t byte_size = FormDataValue<Format>(spec, info, info_bytes);
       tree_builder_.SetElementSize(byte_size);
       return true;
     }
 
     // Offset
     case Dwarf32::Attribute::DW_AT_data_member_location: {
-      uint64_t offset = FormDataValue(form, info, info_bytes);
+      FormValue location = ReadForm<Format>(spec, info, info_bytes);
+      uint64_t offset = location.value;
+      if (location.kind == DwarfForm::Kind::block && location.value > 1 && 
+          location.data[0] == Dwarf32::Operation::DW_OP_plus_uconst) {
+        // Before DWARF 3 the offset was an expression
+        unsigned char* expression = location.data + 1;
+        size_t expression_bytes = location.value - 1;
+        offset = DwarfFile::ULEB128(expression, expression_bytes);
+      }
       tree_builder_.SetElementOffset(offset);
       return true;
     }
 
     // Type
     case Dwarf32::Attribute::DW_AT_type: {
-      uint64_t id = FormDataValue(form, info, info_bytes);
-      if (form != Dwarf32::Form::DW_FORM_ref_addr) {
+      DwarfForm::Kind kind = DwarfForm::Describe(spec.form).kind;
+      if (kind == DwarfForm::Kind::supplementary) {
+        return false; // The type is in a supplementary object file
+      }
+      uint64_t id = FormDataValue<Format>(spec, info, info_bytes);
+      if (kind == DwarfForm::Kind::signature) {
+        // The type is in a type unit, use the type DIE of the first unit
+        // with this signature
+        std::unordered_map<uint64_t, uint64_t>::const_iterator it_type = type_signatures_.find(id);
+        if (it_type == type_signatures_.end()) {
+          return true;
+        }
+        id = it_type->second;
+      } else if (kind == DwarfForm::Kind::reference) {
         // The offset is relative to the current compilation unit, we make it
         // absolute
-        id += reinterpret_cast<char*>(unit_base) - reinterpret_cast<char*>(debug_info_);
+        id += unit_.offset;
       }
       tree_builder_.SetElementType(id);
       return true;
@@ -375,7 +872,7 @@ bool DwarfFile::LogDwarfInfo(
 
     // Count
     case Dwarf32::Attribute::DW_AT_count: {
-      uint64_t count = FormDataValue(form, info, info_bytes);
+      uint64_t count = FormDataValue<Format>(spec, info, info_bytes);
       tree_builder_.SetElementCount(count);
       return true;
     }
@@ -387,94 +884,1444 @@ bool DwarfFile::LogDwarfInfo(
   return false;
 }
 
+void DwarfFile::SetFilter(const std::set<Dwarf32::Tag>& tags, const std::set<Dwarf32::Attribute>& attributes)
+{
+  tag_filter_ = tags;
+  attribute_filter_ = attributes;
+  filter_hash_ = HashMix(tags.size(), attributes.size());
+  for (Dwarf32::Tag tag : tags) {
+    filter_hash_ = HashMix(filter_hash_, tag);
+  }
+  for (Dwarf32::Attribute attribute : attributes) {
+    filter_hash_ = HashMix(filter_hash_, attribute);
+  }
+  compilation_unit_.clear();    // The filters are applied to the abbreviations
+}
+
+bool DwarfFile::SetCacheDirectory(const std::string& directory)
+{
+  unit_cache_.reset(new UnitCache(directory));
+  if (!unit_cache_->Open()) {
+    unit_cache_.reset();
+    return false;
+  }
+  return true;
+}
+
+bool DwarfFile::WriteIndex(const std::string& path)
+{
+  std::string data;
+  return tree_builder_.SaveIndex(data) && TypeIndex::Write(path, data);
+}
+
 bool DwarfFile::GetAllClasses() 
 {
   if (!is_loaded_) {
     return false;
   }
   
-  unsigned char* info = reinterpret_cast<unsigned char*>(debug_info_);
-  size_t info_bytes = debug_info_size_;
+  // The headers of all the units are read first to know the signatures of
+  // the type units
+  bool indexed = IndexUnits();
 
-  while (info_bytes > 0) {
-    // Load the compilation unit information
-    Dwarf32::CompilationUnitHdr* unit_hdr =
-        reinterpret_cast<Dwarf32::CompilationUnitHdr*>(info);
-    DBG_PRINTF("\nunit offset   = 0x%lx\n", info - reinterpret_cast<unsigned char*>(debug_info_));
-    DBG_PRINTF("unit_length   = 0x%x\n", unit_hdr->unit_length);
-    DBG_PRINTF("version       = %d\n", unit_hdr->version);
-    DBG_PRINTF("abbrev_offset = 0x%x\n", unit_hdr->abbrev_offset);
-    DBG_PRINTF("address_size  = %d\n", unit_hdr->address_size);
-    unsigned char* info_end = info + unit_hdr->unit_length + sizeof(uint32_t);
-    info += sizeof(Dwarf32::CompilationUnitHdr);
-    info_bytes -= sizeof(Dwarf32::CompilationUnitHdr);
-
-    if (!LoadAbbrevTags(unit_hdr->abbrev_offset)) {
-      fprintf(stderr, "ERR: Can't load the compilation\n");
-      return false;
+  // A malformed unit is skipped, the next one is found with its length
+  std::vector<const Unit*> units;
+  for (const Unit& unit : units_) {
+    if (!IsDuplicateTypeUnit(unit) && IsUnitWanted(unit)) {
+      units.push_back(&unit);
     }
+  }
 
-    // For all compilation tags
-    int depth = 0;
-    while (info < info_end) {
-      uint64_t tag_id = info - reinterpret_cast<unsigned char*>(debug_info_); 
-      uint32_t abbrev_num = DwarfFile::ULEB128(info, info_bytes);
-
-      // if (tag_id >= 0x0ab78256 && tag_id < 0x0ab7835d) {
-      DBG_PRINTF(".info+%lx\t Tag 0x%lx ; Info Number %d\n", info-reinterpret_cast<unsigned char*>(debug_info_), tag_id, abbrev_num);
-      // }
-
-      if (!abbrev_num) { // Null DIE so end of the children list
-        tree_builder_.EndOfChildren();
-        depth--;
-        continue;
+  ParsePlan plan = PlanParsing(units);
+  if (plan.prefetch_strings) {
+    Prefetch(debug_str_, debug_str_size_);
+  }
+  if (plan.threads > 1) {
+    ParseUnitsInParallel(units, plan);
+  } else {
+    for (const Unit* unit : units) {
+      // The copies of the types defined in several units are removed
+      size_t first_element = tree_builder_.ElementCount();
+      if (ParseUnit(*unit)) {
+        tree_builder_.DeduplicateTypes(first_element, type_table_);
       }
+    }
+  }
+  if (verbose_) {
+    // The elements and the parse stacks of the builder are allocated by
+    // blocks of its arena, the DIEs should need almost none. The scopes and
+    // the declarations of the unit being parsed aren't counted, their vectors
+    // keep their capacity from one unit to the next.
+    fprintf(stderr, "Parsed %lu DIEs, %lu arena heap allocations to store their elements (%.4f per DIE)\n", 
+            static_cast<unsigned long>(parsed_dies_), static_cast<unsigned long>(die_heap_allocations_),
+            parsed_dies_ ? static_cast<double>(die_heap_allocations_) / parsed_dies_ : 0);
+  }
+  tree_builder_.MergeTypes();
 
-      std::map<unsigned int, struct TagSection>::iterator it_section = compilation_unit_.find(abbrev_num);
-      if (it_section == compilation_unit_.end()) {
-        fprintf(stderr, "ERR at 0x%lx: Can't find compilation unit with abbrev number %d\n", 
-            info-reinterpret_cast<unsigned char*>(debug_info_), abbrev_num);
-        return false;
-      }
-      TagSection* section = &it_section->second;
-      unsigned char* abbrev = section->ptr;
-      size_t abbrev_bytes = debug_abbrev_size_ - (abbrev - reinterpret_cast<unsigned char*>(debug_abbrev_));
+  return indexed;
+}
 
-      // if (tag_id >= 0x0ab78256 && tag_id < 0x0ab7835d) {
-      DBG_PRINTF("[%d] section->num = %d; section->type = 0x%x ; has_children = %d\n", depth, section->number, section->type, section->has_children);
-      // }
+namespace {
+  // Seed of the units sampled by SampleTypes
+  const uint64_t kSampleSeed = 0x5eed;
+}
 
-      // Register the new tag (class, structure, namespace, etc.)
-      RegisterNewTag(section->type, tag_id, section->has_children);
+bool DwarfFile::SampleTypes(double percent, std::string& statistics)
+{
+  if (!is_loaded_) {
+    return false;
+  }
+
+  // Only the headers of the units are read to select them
+  bool indexed = IndexUnits();
+  std::vector<const Unit*> units;
+  for (const Unit& unit : units_) {
+    if (!IsDuplicateTypeUnit(unit)) {
+      units.push_back(&unit);
+    }
+  }
+
+  // Selection sampling: each unit is selected with the probability of the
+  // units left to select, they are selected in order. The generator gives the
+  // same numbers everywhere.
+  uint64_t wanted = std::min<uint64_t>(units.size(), std::max(1.0, round(units.size() * percent / 100)));
+  std::mt19937_64 random(kSampleSeed);
+  TypeStatistics type_statistics(units.size());
+  uint64_t selected = 0;
+  for (size_t i = 0; i < units.size() && selected < wanted; i++) {
+    double draw = (random() >> 11) * 0x1.0p-53;
+    if (draw * (units.size() - i) >= wanted - selected) {
+      continue;
+    }
+    selected++;
+
+    // The units filtered out have no type, the estimates are still for all
+    // the units. Only the hashes of the types are kept.
+    std::vector<TreeBuilder::TypeSummary> types;
+    size_t first_element = tree_builder_.ElementCount();
+    if (IsUnitWanted(*units[i]) && ParseUnit(*units[i])) {
+      tree_builder_.SummarizeTypes(first_element, types);
+    }
+    tree_builder_.DiscardElements(first_element);
+    type_statistics.AddUnit(types);
+  }
+  if (verbose_) {
+    fprintf(stderr, "Sampled %lu of %zu units\n", static_cast<unsigned long>(selected), units.size());
+  }
+
+  statistics = type_statistics.GenerateJson();
+  return indexed;
+}
+
+namespace {
+  // Units sampled by PlanParsing, spread over .debug_info, and their first
+  // DIEs read
+  const uint64_t kSampledUnits = 8;
+  const uint64_t kSampledDies = 1024;
+  // Cost of a filtered out DIE, relative to a decoded one
+  const double kSkippedDieCost = 0.25;
+  // Decoded DIEs worth starting a thread
+  const double kDiesPerThread = 200000;
+  // The chunks are small enough to balance the threads, but big enough to
+  // amortize the merge of their elements
+  const uint64_t kChunksPerThread = 16;
+  const uint64_t kMinChunkBytes = 1 << 20;
+}
+
+DwarfFile::ParsePlan DwarfFile::PlanParsing(const std::vector<const Unit*>& units)
+{
+  uint64_t total_bytes = 0;
+  for (const Unit* unit : units) {
+    total_bytes += unit->end - unit->begin;
+  }
+
+  // The density of DIEs and the share of filtered out ones vary with the
+  // compiler and the filters, they are measured on a few units
+  UnitSample sample = {};
+  uint64_t sample_step = std::max<uint64_t>(1, (units.size() + kSampledUnits - 1) / kSampledUnits);
+  for (size_t i = 0; i < units.size(); i += sample_step) {
+    unit_ = *units[i];
+    malformed_ = false;
+    if (LoadAbbrevTags(unit_)) {
+      DecodeWithUnitFormat(unit_, [&](auto format) {
+        typedef decltype(format) Format;
+        ReadUnitBases<Format>(unit_.dies, unit_.end - unit_.dies);
+        SampleUnitDies<Format>(sample);
+        return true;
+      });
+    }
+    sample.units++;
+  }
+
+  double dies_per_byte = sample.bytes ? static_cast<double>(sample.dies) / sample.bytes : 0;
+  double skipped_share = sample.dies ? static_cast<double>(sample.skipped_dies) / sample.dies : 0;
+  double section_string_share = sample.strings ? static_cast<double>(sample.section_strings) / sample.strings : 0;
+  double estimated_dies = total_bytes * dies_per_byte * (1 - skipped_share + skipped_share * kSkippedDieCost);
+
+  ParsePlan plan = {};
+  plan.threads = thread_count_;
+  if (!plan.threads) {
+    plan.threads = std::max(1u, std::thread::hardware_concurrency());
+    plan.threads = std::min<uint64_t>(plan.threads, std::max(1.0, estimated_dies / kDiesPerThread));
+  }
+  plan.threads = std::max<uint64_t>(1, std::min<uint64_t>(plan.threads, units.size()));
+  plan.chunk_bytes = std::max(kMinChunkBytes, total_bytes / (plan.threads * kChunksPerThread));
+  // The pages of a mapped file are read ahead of the threads, each thread
+  // requests the chunk it will parse next
+  plan.prefetch_chunks = (memfile_ && plan.threads > 1) ? plan.threads : 0;
+  // The strings of the DIEs are read at random in .debug_str
+  plan.prefetch_strings = memfile_ && section_string_share >= 0.5 && debug_str_size_ >= kMinChunkBytes;
+
+  if (verbose_) {
+    fprintf(stderr, "%zu units, %lu KB of DIEs. Sampled %lu units: %.1f DIEs/KB, %.0f%% filtered out, "
+            "%.0f%% of the strings in a string section\n", units.size(), 
+            static_cast<unsigned long>(total_bytes >> 10), static_cast<unsigned long>(sample.units), 
+            dies_per_byte * 1024, skipped_share * 100, section_string_share * 100);
+    fprintf(stderr, "Plan: %u threads, chunks of %lu KB, prefetch %u chunks ahead%s\n", plan.threads, 
+            static_cast<unsigned long>(plan.chunk_bytes >> 10), plan.prefetch_chunks, 
+            plan.prefetch_strings ? ", .debug_str prefetched" : "");
+  }
+  return plan;
+}
+
+template <typename Format>
+void DwarfFile::SampleUnitDies(UnitSample& sample)
+{
+  unsigned char* info = unit_.dies;
+  size_t info_bytes = unit_.end - unit_.dies;
+  uint64_t end_die = sample.dies + kSampledDies;
+  while (!malformed_ && info < unit_.end && sample.dies < end_die) {
+    uint32_t abbrev_num = DwarfFile::ULEB128(info, info_bytes);
+    if (!abbrev_num) {
+      continue;
+    }
+    CompilationUnit::const_iterator it_section = compilation_unit_.find(abbrev_num);
+    if (it_section == compilation_unit_.end() || it_section->second.fixed_size > info_bytes) {
+      break;
+    }
+
+    sample.dies++;
+    if (!it_section->second.wanted) {
+      sample.skipped_dies++;
+    }
+    for (const AttributeSpec& spec : it_section->second.attributes) {
+      DwarfForm::Kind kind = DwarfForm::Describe(spec.form).kind;
+      if (spec.logged && (kind == DwarfForm::Kind::string_offset || kind == DwarfForm::Kind::string_index || 
+                          kind == DwarfForm::Kind::line_string_offset || kind == DwarfForm::Kind::inline_string)) {
+        sample.strings++;
+        sample.section_strings += kind != DwarfForm::Kind::inline_string;
+      }
+      DwarfFile::PassData<Format>(spec, info, info_bytes);
+    }
+  }
+  if (!malformed_) {
+    sample.bytes += info - unit_.dies;
+  }
+}
+
+void DwarfFile::Prefetch(const void* data, size_t size) const
+{
+  // Only a hint, the pages must be aligned
+  uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  uintptr_t begin = reinterpret_cast<uintptr_t>(data) & ~(page_size - 1);
+  uintptr_t end = reinterpret_cast<uintptr_t>(data) + size;
+  if (data && size) {
+    madvise(reinterpret_cast<void*>(begin), end - begin, MADV_WILLNEED);
+  }
+}
+
+std::unique_ptr<DwarfFile> DwarfFile::NewWorker() const
+{
+  // The worker reads the same sections with the same settings, the parsing
+  // state and the elements are its own. It doesn't own the file mapping.
+  std::unique_ptr<DwarfFile> worker(new DwarfFile());
+  worker->SetDebugPointers(debug_info_, debug_info_size_, debug_abbrev_, debug_abbrev_size_, 
+                           debug_str_, debug_str_size_);
+  std::copy(std::begin(sections_), std::end(sections_), std::begin(worker->sections_));
+  worker->tag_filter_ = tag_filter_;
+  worker->attribute_filter_ = attribute_filter_;
+  worker->filter_hash_ = filter_hash_;
+  worker->units_indexed_ = true;
+  worker->type_signatures_ = type_signatures_;
+  worker->type_die_signatures_ = type_die_signatures_;
+  if (unit_cache_) {
+    worker->unit_cache_.reset(new UnitCache(*unit_cache_));
+  }
+  return worker;
+}
+
+void DwarfFile::ParseUnitsInParallel(const std::vector<const Unit*>& units, const ParsePlan& plan)
+{
+  // Consecutive units parsed by the same worker, in their own tree
+  struct Chunk {
+    size_t first_unit;
+    size_t end_unit;
+    unsigned char* begin;
+    unsigned char* end;
+    TreeBuilder tree_builder;
+    std::vector<size_t> unit_ends;  // Element count of tree_builder after each unit
+    bool parsed;
+  };
+  std::vector<Chunk> chunks;
+  for (size_t i = 0; i < units.size(); i++) {
+    if (chunks.empty() || static_cast<uint64_t>(chunks.back().end - chunks.back().begin) >= plan.chunk_bytes || 
+        units[i]->section != units[i - 1]->section) {
+      chunks.emplace_back();
+      chunks.back().first_unit = i;
+      chunks.back().begin = units[i]->begin;
+      chunks.back().parsed = false;
+    }
+    chunks.back().end_unit = i + 1;
+    chunks.back().end = units[i]->end;
+  }
+
+  if (unit_cache_) {
+    IndexTypeDieSignatures();   // Shared by the workers
+  }
+  std::mutex mutex;
+  std::condition_variable chunk_parsed;
+  std::atomic<size_t> next_chunk(0);
+  auto parse_chunks = [&](DwarfFile* worker) {
+    for (size_t i = next_chunk++; i < chunks.size(); i = next_chunk++) {
+      if (plan.prefetch_chunks && i + plan.prefetch_chunks < chunks.size()) {
+        const Chunk& ahead = chunks[i + plan.prefetch_chunks];
+        Prefetch(ahead.begin, ahead.end - ahead.begin);
+      }
+      Chunk& chunk = chunks[i];
+      for (size_t unit = chunk.first_unit; unit < chunk.end_unit; unit++) {
+        worker->ParseUnit(*units[unit]);
+        chunk.unit_ends.push_back(worker->tree_builder_.ElementCount());
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      chunk.tree_builder = std::move(worker->tree_builder_);
+      worker->tree_builder_ = TreeBuilder();
+      chunk.parsed = true;
+      chunk_parsed.notify_all();
+    }
+  };
+
+  std::vector<std::unique_ptr<DwarfFile>> workers;
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < plan.threads; i++) {
+    workers.push_back(NewWorker());
+    threads.emplace_back(parse_chunks, workers.back().get());
+  }
+
+  // The chunks are merged in the order of the units while the next ones are
+  // parsed. The output doesn't depend on the threads.
+  for (Chunk& chunk : chunks) {
+    std::unique_lock<std::mutex> lock(mutex);
+    chunk_parsed.wait(lock, [&chunk]() { return chunk.parsed; });
+    TreeBuilder chunk_tree_builder = std::move(chunk.tree_builder);
+    lock.unlock();
+    tree_builder_.AppendUnits(chunk_tree_builder, chunk.unit_ends, type_table_);
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  for (const std::unique_ptr<DwarfFile>& worker : workers) {
+    parsed_dies_ += worker->parsed_dies_;
+    die_heap_allocations_ += worker->die_heap_allocations_;
+  }
+}
+
+static bool MatchesPattern(const char* value, const std::vector<std::string>& patterns)
+{
+  for (const std::string& pattern : patterns) {
+    if (value && !fnmatch(pattern.c_str(), value, 0)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool DwarfFile::IsUnitWanted(const Unit& unit)
+{
+  if (unit_filter_.empty()) {
+    return true;
+  }
+
+  // Only the abbreviation of the root DIE is read, usually the first one
+  if (unit.abbrev_offset >= debug_abbrev_size_) {
+    return true;    // Reported by ParseUnit
+  }
+  unsigned char* info = unit.dies;
+  size_t info_bytes = unit.end - unit.dies;
+  uint32_t root_code = DwarfFile::ULEB128(info, info_bytes);
+  unsigned char* abbrev = reinterpret_cast<unsigned char*>(debug_abbrev_) + unit.abbrev_offset;
+  size_t abbrev_bytes = debug_abbrev_size_ - unit.abbrev_offset;
+  TagSection root;
+  bool found = false;
+  while (root_code && !found && ReadAbbrev(unit, abbrev, abbrev_bytes, root)) {
+    found = root.number == root_code;
+  }
+
+  // The malformed units are kept, ParseUnit reports them
+  unit_ = unit;
+  malformed_ = false;
+  UnitRoot root_attributes = {};
+  bool decoded = found && DecodeWithUnitFormat(unit_, [&](auto format) {
+    return ReadUnitRoot<decltype(format)>(root, root_attributes);
+  });
+  if (!decoded || malformed_) {
+    return true;
+  }
+
+  bool type_unit = unit.unit_type == Dwarf32::UnitType::DW_UT_type || 
+                   unit.unit_type == Dwarf32::UnitType::DW_UT_split_type;
+  if (!type_unit) {
+    if ((!unit_filter_.names.empty() && !MatchesPattern(root_attributes.name, unit_filter_.names)) || 
+        MatchesPattern(root_attributes.name, unit_filter_.excluded_names) || 
+        (!unit_filter_.producers.empty() && !MatchesPattern(root_attributes.producer, unit_filter_.producers)) || 
+        MatchesPattern(root_attributes.producer, unit_filter_.excluded_producers)) {
+      return false;
+    }
+  }
+  Dwarf32::Language language = static_cast<Dwarf32::Language>(root_attributes.language);
+  if (!unit_filter_.languages.empty() && 
+      (!root_attributes.has_language || !unit_filter_.languages.count(language))) {
+    return false;
+  }
+  return !root_attributes.has_language || !unit_filter_.excluded_languages.count(language);
+}
+
+template <typename Format>
+bool DwarfFile::ReadUnitRoot(const TagSection& root, UnitRoot& root_attributes)
+{
+  unsigned char* info = unit_.dies;
+  size_t info_bytes = unit_.end - unit_.dies;
+  DwarfFile::ULEB128(info, info_bytes);
+  if (root.fixed_size > info_bytes) {
+    return false;
+  }
+
+  // The strings are resolved after the loop, DW_AT_str_offsets_base can be
+  // listed after them
+  const AttributeSpec* name_spec = nullptr;
+  const AttributeSpec* producer_spec = nullptr;
+  FormValue name = {};
+  FormValue producer = {};
+  for (const AttributeSpec& spec : root.attributes) {
+    switch (spec.attribute) {
+      case Dwarf32::Attribute::DW_AT_name:
+        name_spec = &spec;
+        name = ReadForm<Format>(spec, info, info_bytes);
+        break;
+      case Dwarf32::Attribute::DW_AT_producer:
+        producer_spec = &spec;
+        producer = ReadForm<Format>(spec, info, info_bytes);
+        break;
+      case Dwarf32::Attribute::DW_AT_language:
+        root_attributes.language = FormDataValue<Format>(spec, info, info_bytes);
+        root_attributes.has_language = true;
+        break;
+      case Dwarf32::Attribute::DW_AT_str_offsets_base:
+        unit_.str_offsets_base = FormDataValue<Format>(spec, info, info_bytes);
+        break;
+      default:
+        DwarfFile::PassData<Format>(spec, info, info_bytes);
+        break;
+    }
+  }
+  if (malformed_) {
+    return false;
+  }
+
+  if (name_spec) {
+    root_attributes.name = StringValue<Format>(*name_spec, name);
+  }
+  if (producer_spec) {
+    root_attributes.producer = StringValue<Format>(*producer_spec, producer);
+  }
+  return true;
+}
+
+bool DwarfFile::ParseUnit(const Unit& unit)
+{
+  unit_ = unit;
+  DBG_PRINTF("\nunit offset   = 0x%lx\n", unit_.offset);
+  DBG_PRINTF("unit_length   = 0x%lx\n", unit_.end - unit_.begin);
+  DBG_PRINTF("version       = %d\n", unit_.version);
+  DBG_PRINTF("unit_type     = %d\n", unit_.unit_type);
+  DBG_PRINTF("offset_size   = %d\n", unit_.offset_size);
+  DBG_PRINTF("abbrev_offset = 0x%lx\n", unit_.abbrev_offset);
+  DBG_PRINTF("address_size  = %d\n", unit_.address_size);
+
+  if (!LoadAbbrevTags(unit_)) {
+    fprintf(stderr, "ERR: Can't load the compilation\n");
+    return false;
+  }
+
+  // A unit which didn't change since a previous run isn't parsed again. It's
+  // found by its bytes, or when the other units moved its strings, by the
+  // content of its DIEs.
+  tree_builder_.BeginUnit();
+  size_t first_element = tree_builder_.ElementCount();
+  uint64_t heap_allocations = tree_builder_.HeapAllocations();
+  uint64_t cache_key = unit_cache_ ? UnitHash() : 0;
+  uint64_t content_key = 0;
+  bool cached = cache_key && LoadCachedUnit(cache_key, true);
+  if (!cached && unit_cache_) {
+    content_key = UnitContentHash();
+    cached = content_key && LoadCachedUnit(content_key, false);
+  }
+
+  bool parsed = cached;
+  if (!cached) {
+    malformed_ = false;
+    scopes_.clear();
+    unit_declarations_.clear();
+    parsed = DecodeWithUnitFormat(unit_, [&](auto format) {
+      typedef decltype(format) Format;
+      unsigned char* info = unit_.dies;
+      size_t info_bytes = unit_.end - unit_.dies;
+      ReadUnitBases<Format>(info, info_bytes);
+      return ParseDies<Format>(info, info_bytes, false);
+    }) && !malformed_;
+  }
+  tree_builder_.EndUnit();
+  die_heap_allocations_ += tree_builder_.HeapAllocations() - heap_allocations;
+
+  if (!parsed) {
+    fprintf(stderr, "ERR: Malformed unit at 0x%lx, skipped\n", static_cast<unsigned long>(unit_.offset));
+    tree_builder_.DiscardElements(first_element);
+    return false;
+  }
+
+  // Saved before the deduplication, which depends on the other units. Not
+  // if values are read in other sections (see HashUnitDies).
+  if (!cached && content_key) {
+    StoreCachedUnit(cache_key, content_key, first_element);
+  }
+  return true;
+}
+
+uint64_t DwarfFile::UnitHeaderHash() const
+{
+  // Everything the elements of the unit depend on besides its DIEs: the
+  // filters, its header and its abbreviations
+  uint64_t hash = HashMix(filter_hash_, compilation_unit_hash_);
+  hash = HashMix(hash, unit_.version | (unit_.unit_type << 16) | (unit_.address_size << 24) | 
+                       (static_cast<uint64_t>(unit_.offset_size) << 32));
+  return HashMix(HashMix(hash, unit_.type_signature), unit_.type_offset);
+}
+
+uint64_t DwarfFile::UnitHash()
+{
+  // The bytes of the DIEs and of the contribution of the unit to
+  // .debug_str_offsets. Only the bases of the root DIE are decoded. The
+  // strings of the sections are referenced by offset, the cache entry lists
+  // them to check them (see CheckCachedStrings).
+  uint64_t hash = HashMix(UnitHeaderHash(), 1);
+  hash = HashBytes(hash, unit_.dies, unit_.end - unit_.dies);
+  DecodeWithUnitFormat(unit_, [&](auto format) {
+    typedef decltype(format) Format;
+    ReadUnitBases<Format>(unit_.dies, unit_.end - unit_.dies);
+    return true;
+  });
+  const OptionalSection& str_offsets = section(DebugSection::str_offsets);
+  if (str_offsets.data && unit_.str_offsets_base <= str_offsets.size) {
+    // The contribution follows its header: unit_length, version and padding.
+    // Without one, the rest of the section is hashed.
+    uint64_t end = str_offsets.size;
+    uint64_t header_size = 4 + unit_.offset_size;
+    if (unit_.str_offsets_base >= header_size) {
+      uint64_t length = DwarfForm::ReadUnsigned(str_offsets.data + unit_.str_offsets_base - header_size, 
+                                                unit_.offset_size);
+      if (length >= 4 && length - 4 <= str_offsets.size - unit_.str_offsets_base) {
+        end = unit_.str_offsets_base + length - 4;
+      }
+    }
+    hash = HashBytes(hash, str_offsets.data + unit_.str_offsets_base, end - unit_.str_offsets_base);
+  }
+  hash = HashFinalize(hash);
+  return hash ? hash : 1;
+}
+
+uint64_t DwarfFile::UnitContentHash()
+{
+  // The values the DIEs decode to, with the content of their strings. 0 if
+  // the unit can't be decoded.
+  uint64_t hash = UnitHeaderHash();
+  malformed_ = false;
+  bool hashed = DecodeWithUnitFormat(unit_, [&](auto format) {
+    typedef decltype(format) Format;
+    unsigned char* info = unit_.dies;
+    size_t info_bytes = unit_.end - unit_.dies;
+    ReadUnitBases<Format>(info, info_bytes);
+    HashUnitDies<Format>(hash);
+    return true;
+  });
+  if (!hashed || malformed_) {
+    return 0;
+  }
+  hash = HashFinalize(hash);
+  return hash ? hash : 1;
+}
+
+template <typename Format>
+void DwarfFile::HashUnitDies(uint64_t& hash)
+{
+  // Only what ParseDies reads is hashed: the position and the abbreviation of
+  // the DIEs, and the attributes it decodes. The strings are hashed by
+  // content, their offsets change with the other units. The other attributes
+  // are skipped the same way.
+  unsigned char* info = unit_.dies;
+  size_t info_bytes = unit_.end - unit_.dies;
+  while (!malformed_ && info < unit_.end) {
+    uint64_t die_offset = info - unit_.begin;
+    uint32_t abbrev_num = DwarfFile::ULEB128(info, info_bytes);
+    hash = HashMix(HashMix(hash, die_offset), abbrev_num);
+    if (!abbrev_num) {
+      continue;
+    }
+
+    CompilationUnit::const_iterator it_section = compilation_unit_.find(abbrev_num);
+    if (it_section == compilation_unit_.end() || it_section->second.fixed_size > info_bytes) {
+      SetMalformed(info, info_bytes);
+      return;
+    }
 
-      // Increment the depth for the next children 
-      if (section->has_children) {
-        depth++;
+    const std::vector<AttributeSpec>& attributes = it_section->second.attributes;
+    for (size_t i = 0; i < attributes.size();) {
+      const AttributeSpec& spec = attributes[i];
+      if (spec.skip_count) {
+        info += spec.skip_size;
+        info_bytes -= spec.skip_size;
+        i += spec.skip_count;
+        continue;
+      }
+      i++;
+      if (!spec.logged) {
+        DwarfFile::PassData<Format>(spec, info, info_bytes);
+        continue;
       }
 
-      // For all attributes
-      while (true) {
-        Dwarf32::Attribute abbrev_attribute = static_cast<Dwarf32::Attribute>(DwarfFile::ULEB128(abbrev, abbrev_bytes));
-        Dwarf32::Form abbrev_form = static_cast<Dwarf32::Form>(DwarfFile::ULEB128(abbrev, abbrev_bytes));
-        if (!abbrev_attribute && !abbrev_form) {
-          // End of the attribute list
+      DwarfForm::Descriptor descriptor = DwarfForm::Describe(spec.form);
+      switch (descriptor.kind) {
+        case DwarfForm::Kind::string_offset:
+        case DwarfForm::Kind::line_string_offset:
+        case DwarfForm::Kind::string_index: {
+          const char* str = FormStringValue<Format>(spec, info, info_bytes);
+          hash = str ? HashBytes(hash, str, strlen(str)) : HashMix(hash, 0);
+          break;
+        }
+        case DwarfForm::Kind::none:             // DW_FORM_indirect
+        case DwarfForm::Kind::address:
+        case DwarfForm::Kind::address_index:
+        case DwarfForm::Kind::section_offset:
+        case DwarfForm::Kind::list_index:
+          // Value read in another section, not worth a cache entry
+          SetMalformed(info, info_bytes);
+          return;
+        default: {
+          unsigned char* value = info;
+          DwarfFile::PassData<Format>(spec, info, info_bytes);
+          hash = HashBytes(hash, value, info - value);
           break;
         }
+      }
+    }
+  }
+}
+
+bool DwarfFile::LoadCachedUnit(uint64_t key, bool check_strings)
+{
+  std::vector<char> data;
+  if (!unit_cache_->Load(key, data)) {
+    return false;
+  }
+  if (check_strings && !CheckCachedStrings(data)) {
+    return false;     // Strings changed in place, the unit is parsed again
+  }
+  if (!tree_builder_.LoadElements(std::move(data), unit_.offset, unit_.end - unit_.begin, type_signatures_)) {
+    fprintf(stderr, "ERR: Invalid cache entry for the unit at 0x%lx, parsed again\n", 
+            static_cast<unsigned long>(unit_.offset));
+    return false;
+  }
+  return true;
+}
+
+namespace {
+  // Strings checked by an entry of UnitHash: their count, the hash of their
+  // content, then their offsets times 2, plus 1 in .debug_line_str
+  struct CachedStrings {
+    uint64_t count;
+    uint64_t hash;
+  };
+}
+
+bool DwarfFile::CheckCachedStrings(std::vector<char>& data) const
+{
+  // The strings must still be at the same offsets, then they are removed
+  // from the data
+  CachedStrings header;
+  if (data.size() < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, data.data(), sizeof(header));
+  if (header.count > (data.size() - sizeof(header)) / sizeof(uint64_t)) {
+    return false;
+  }
+  const OptionalSection& line_str = section(DebugSection::line_str);
+  uint64_t hash = 0;
+  for (uint64_t i = 0; i < header.count; i++) {
+    uint64_t location;
+    memcpy(&location, data.data() + sizeof(header) + i * sizeof(location), sizeof(location));
+    const char* strings = (location & 1) ? reinterpret_cast<const char*>(line_str.data) : 
+                                           static_cast<const char*>(debug_str_);
+    uint64_t strings_size = (location & 1) ? line_str.size : debug_str_size_;
+    uint64_t offset = location >> 1;
+    if (!strings || offset >= strings_size) {
+      return false;
+    }
+    size_t length = strnlen(strings + offset, strings_size - offset);
+    hash = HashBytes(hash, strings + offset, length);
+  }
+  if (hash != header.hash) {
+    return false;
+  }
+  data.erase(data.begin(), data.begin() + sizeof(header) + header.count * sizeof(uint64_t));
+  return true;
+}
+
+void DwarfFile::IndexTypeDieSignatures()
+{
+  // The references to the type units are saved by signature
+  if (type_die_signatures_.size() != type_signatures_.size()) {
+    for (const std::pair<const uint64_t, uint64_t>& type : type_signatures_) {
+      type_die_signatures_.emplace(type.second, type.first);
+    }
+  }
+}
+
+void DwarfFile::StoreCachedUnit(uint64_t key, uint64_t content_key, size_t first_element)
+{
+  IndexTypeDieSignatures();
+  std::string data;
+  std::vector<const char*> strings;
+  if (!tree_builder_.SaveElements(first_element, unit_.offset, unit_.end - unit_.begin, 
+                                  type_die_signatures_, data, strings)) {
+    return;
+  }
+  unit_cache_->Store(content_key, data);
+
+  // The bytes of the unit only reference the strings of the sections by
+  // offset, the entry of key lists them. The inline strings are in the bytes.
+  const OptionalSection& line_str = section(DebugSection::line_str);
+  std::sort(strings.begin(), strings.end());
+  strings.erase(std::unique(strings.begin(), strings.end()), strings.end());
+  CachedStrings header = {0, 0};
+  std::string locations;
+  const unsigned char* debug_str = static_cast<const unsigned char*>(debug_str_);
+  for (const char* str : strings) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(str);
+    uint64_t location;
+    if (bytes >= unit_.dies && bytes < unit_.end) {
+      continue;
+    } else if (bytes >= debug_str && bytes < debug_str + debug_str_size_) {
+      location = (bytes - debug_str) << 1;
+    } else if (line_str.data && bytes >= line_str.data && bytes < line_str.data + line_str.size) {
+      location = ((bytes - line_str.data) << 1) | 1;
+    } else {
+      return;     // Not found by offset
+    }
+    header.hash = HashBytes(header.hash, str, strlen(str));
+    header.count++;
+    locations.append(reinterpret_cast<const char*>(&location), sizeof(location));
+  }
+  if (key) {
+    unit_cache_->Store(key, std::string(reinterpret_cast<const char*>(&header), sizeof(header)) + 
+                            locations + data);
+  }
+}
+
+bool DwarfFile::ParseDieTree(uint64_t die_offset)
+{
+  // The DIEs of the unit are indexed to detect a reference inside a DIE and
+  // to find the ancestors giving the scope of the tree
+  const Unit* unit = FindUnit(die_offset);
+  const std::vector<DieIndexEntry>* dies = unit ? &UnitDies(unit - units_.data()) : nullptr;
+  const DieIndexEntry* die = dies ? FindDie(*dies, die_offset) : nullptr;
+  if (!die) {
+    fprintf(stderr, "ERR: No unit contains the DIE 0x%lx\n", static_cast<unsigned long>(die_offset));
+    return false;
+  }
+
+  unit_ = *unit;
+  if (!LoadAbbrevTags(unit_)) {
+    return false;
+  }
+
+  malformed_ = false;
+  scopes_.clear();
+  unit_declarations_.clear();
+  size_t first_element = tree_builder_.ElementCount();
+  bool parsed = DecodeWithUnitFormat(unit_, [&](auto format) {
+    typedef decltype(format) Format;
+    // The bases are still read from the root DIE of the unit
+    unsigned char* info = unit_.dies;
+    size_t info_bytes = unit_.end - unit_.dies;
+    ReadUnitBases<Format>(info, info_bytes);
+
+    // The tree starts in the scope given by its ancestors in ParseUnit. A
+    // root defined out of its declaration also takes its name.
+    scopes_.push_back(DieScope<Format>(*dies, die - dies->data()));
+    uint64_t specification = 0;
+    DieName<Format>(*die, &specification);
+    const DieIndexEntry* declaration = specification ? FindDie(*dies, specification) : nullptr;
+    if (declaration && declaration < die) {
+      unit_declarations_.push_back({specification, scopes_.back(), DieName<Format>(*declaration)});
+    }
+
+    info = unit_.begin + (die_offset - unit_.offset);
+    info_bytes = unit_.end - info;
+    return ParseDies<Format>(info, info_bytes, true);
+  });
+  tree_builder_.EndUnit();
+
+  if (!parsed || malformed_) {
+    fprintf(stderr, "ERR: Malformed DIE 0x%lx\n", static_cast<unsigned long>(die_offset));
+    tree_builder_.DiscardElements(first_element);
+    return false;
+  }
+  return true;
+}
+
+bool DwarfFile::IndexUnitsOfSection(unsigned char* section, size_t section_size, uint64_t id_base)
+{
+  // Only the headers are read, the length of each unit gives the next one
+  unsigned char* info = section;
+  size_t info_bytes = section_size;
+  while (info_bytes > 0) {
+    Unit unit;
+    unit.section = section;
+    unit.offset = id_base + (info - section);
+    if (ReadUnitHeader(info, info_bytes, unit)) {
+      units_.push_back(unit);
+    } else if (unit.end) {
+      // Only the length of the unit is valid, it is skipped
+      fprintf(stderr, "ERR: Invalid unit at 0x%lx, skipped\n", static_cast<unsigned long>(unit.offset));
+      unit.type_signature = 0;
+    } else {
+      return false;
+    }
+    info_bytes -= unit.end - info;
+    info = unit.end;
+
+    // The first type unit of a signature is the canonical one
+    if (unit.type_signature) {
+      type_signatures_.insert(std::make_pair(unit.type_signature, unit.offset + unit.type_offset));
+    }
+  }
+
+  return true;
+}
+
+bool DwarfFile::IndexUnits()
+{
+  if (units_indexed_) {
+    return true;
+  }
+  units_indexed_ = true;
+
+  // The DIEs of .debug_types are identified after the ones of .debug_info
+  if (!IndexUnitsOfSection(reinterpret_cast<unsigned char*>(debug_info_), debug_info_size_, 0)) {
+    return false;
+  }
+  if (section(DebugSection::types).data && 
+      !IndexUnitsOfSection(section(DebugSection::types).data, section(DebugSection::types).size, debug_info_size_)) {
+    return false;
+  }
+  return true;
+}
+
+bool DwarfFile::IsDuplicateTypeUnit(const Unit& unit) const
+{
+  if (!unit.type_signature) {
+    return false;
+  }
+
+  // Only the signature is read, not the DIEs
+  std::unordered_map<uint64_t, uint64_t>::const_iterator it_type = type_signatures_.find(unit.type_signature);
+  return it_type != type_signatures_.end() && it_type->second != unit.offset + unit.type_offset;
+}
+
+const DwarfFile::Unit* DwarfFile::FindUnit(uint64_t die_offset)
+{
+  if (!IndexUnits()) {
+    return nullptr;
+  }
+
+  std::vector<Unit>::const_iterator it_unit = std::upper_bound(units_.begin(), units_.end(), die_offset,
+      [](uint64_t offset, const Unit& unit) { return offset < unit.offset; });
+  if (it_unit == units_.begin()) {
+    return nullptr;
+  }
+  it_unit--;
+
+  if (die_offset - it_unit->offset >= static_cast<uint64_t>(it_unit->end - it_unit->begin)) {
+    return nullptr;
+  }
+  return &*it_unit;
+}
+
+const std::vector<DwarfFile::DieIndexEntry>& DwarfFile::UnitDies(uint32_t unit_index)
+{
+  // The units must be indexed, only the ones searched are walked
+  if (unit_dies_.size() != units_.size()) {
+    unit_dies_.resize(units_.size());
+    unit_dies_indexed_.resize(units_.size(), false);
+  }
+  std::vector<DieIndexEntry>& dies = unit_dies_[unit_index];
+  if (unit_dies_indexed_[unit_index]) {
+    return dies;
+  }
+  unit_dies_indexed_[unit_index] = true;
+
+  // The DIEs of a malformed unit are not indexed
+  unit_ = units_[unit_index];
+  malformed_ = false;
+  bool indexed = LoadAbbrevTags(unit_) && DecodeWithUnitFormat(unit_, [&](auto format) {
+    return IndexUnitDies<decltype(format)>(unit_, dies);
+  });
+  if (!indexed || malformed_) {
+    fprintf(stderr, "ERR: Malformed unit at 0x%lx, skipped\n", static_cast<unsigned long>(unit_.offset));
+    dies.clear();
+  }
+  DBG_PRINTF("%lu DIEs indexed in the unit at 0x%lx\n", dies.size(), unit_.offset);
+  return dies;
+}
+
+template <typename Format>
+bool DwarfFile::IndexUnitDies(const Unit& unit, std::vector<DieIndexEntry>& dies)
+{
+  unsigned char* info = unit.dies;
+  size_t info_bytes = unit.end - unit.dies;
+
+  // The attributes are skipped, only the abbreviation code and the position
+  // in the tree are kept
+  std::vector<uint32_t> parents;
+  while (!malformed_ && info < unit.end) {
+    uint64_t die_offset = unit.offset + (info - unit.begin);
+    uint32_t abbrev_code = DwarfFile::ULEB128(info, info_bytes);
+    if (!abbrev_code) { // Null DIE so end of the children list
+      if (!parents.empty()) {
+        parents.pop_back();
+      }
+      continue;
+    }
+
+    CompilationUnit::const_iterator it_section = compilation_unit_.find(abbrev_code);
+    if (it_section == compilation_unit_.end()) {
+      fprintf(stderr, "ERR at 0x%lx: Can't find compilation unit with abbrev number %d\n", 
+          static_cast<unsigned long>(die_offset), abbrev_code);
+      SetMalformed(info, info_bytes);
+      break;
+    }
+    if (it_section->second.fixed_size > info_bytes) {
+      SetMalformed(info, info_bytes);
+      break;
+    }
+
+    uint32_t index = static_cast<uint32_t>(dies.size());
+    DieIndexEntry die = {die_offset, abbrev_code, parents.empty() ? index : parents.back()};
+    dies.push_back(die);
+
+    if (it_section->second.fixed_size_only) {
+      info += it_section->second.fixed_size;
+      info_bytes -= it_section->second.fixed_size;
+    } else {
+      for (const AttributeSpec& spec : it_section->second.attributes) {
+        DwarfFile::PassData<Format>(spec, info, info_bytes);
+      }
+    }
+    if (it_section->second.has_children) {
+      parents.push_back(index);
+    }
+  }
+
+  return true;
+}
+
+// static
+const DwarfFile::DieIndexEntry* DwarfFile::FindDie(const std::vector<DieIndexEntry>& dies, uint64_t die_offset)
+{
+  std::vector<DieIndexEntry>::const_iterator it_die = std::lower_bound(dies.begin(), dies.end(), 
+      die_offset, [](const DieIndexEntry& die, uint64_t offset) { return die.offset < offset; });
+  if (it_die == dies.end() || it_die->offset != die_offset) {
+    return nullptr;
+  }
+  return &*it_die;
+}
+
+template <typename Format>
+char* DwarfFile::DieName(const DieIndexEntry& die, uint64_t* specification)
+{
+  // The abbreviations and the bases of the DIE unit must be loaded. The
+  // attributes after the name are only read for the specification.
+  unsigned char* info = unit_.begin + (die.offset - unit_.offset);
+  size_t info_bytes = unit_.end - info;
+  DwarfFile::ULEB128(info, info_bytes);
+  if (specification) {
+    *specification = 0;
+  }
+
+  CompilationUnit::const_iterator it_section = compilation_unit_.find(die.abbrev_code);
+  if (it_section == compilation_unit_.end() || it_section->second.fixed_size > info_bytes) {
+    return nullptr;
+  }
+  char* name = nullptr;
+  for (const AttributeSpec& spec : it_section->second.attributes) {
+    if (spec.attribute == Dwarf32::Attribute::DW_AT_name) {
+      name = FormStringValue<Format>(spec, info, info_bytes);
+      if (!specification) {
+        break;
+      }
+    } else if (specification && spec.attribute == Dwarf32::Attribute::DW_AT_specification) {
+      *specification = FormReferenceValue<Format>(spec, info, info_bytes);
+    } else {
+      DwarfFile::PassData<Format>(spec, info, info_bytes);
+    }
+  }
+  return name;
+}
+
+template <typename Format>
+uint32_t DwarfFile::DieScope(const std::vector<DieIndexEntry>& dies, size_t die)
+{
+  // Like ParseDies, a definition has the scope of a previous declaration
+  // given by DW_AT_specification. The abbreviations and the bases of the
+  // unit must be loaded.
+  uint64_t specification = 0;
+  DieName<Format>(dies[die], &specification);
+  const DieIndexEntry* declaration = specification ? FindDie(dies, specification) : nullptr;
+  if (declaration && declaration < &dies[die]) {
+    return DieScope<Format>(dies, declaration - dies.data());
+  }
+
+  // Otherwise the scope of the children of the parent is interned by
+  // ChildrenScope like in ParseDies
+  size_t parent = dies[die].parent;
+  if (parent == die) {
+    return TreeBuilder::kGlobalScope;   // Root DIE of the unit
+  }
+  CompilationUnit::const_iterator it_section = compilation_unit_.find(dies[parent].abbrev_code);
+  if (it_section == compilation_unit_.end()) {
+    return TreeBuilder::kLocalScope;
+  }
+  uint32_t parent_scope = DieScope<Format>(dies, parent);
+  die_name_ = DieName<Format>(dies[parent], &specification);
+  declaration = specification ? FindDie(dies, specification) : nullptr;
+  if (!die_name_ && declaration && declaration < &dies[parent]) {
+    die_name_ = DieName<Format>(*declaration);
+  }
+  return ChildrenScope(it_section->second.type, parent_scope);
+}
+
+template <typename Format>
+bool DwarfFile::DieScopeName(const std::vector<DieIndexEntry>& dies, size_t die, std::string& scope_name)
+{
+  uint32_t scope = DieScope<Format>(dies, die);
+  if (scope == TreeBuilder::kLocalScope) {
+    return false;       // Function, block or member of an anonymous type
+  }
+  scope_name = tree_builder_.ScopeName(scope);
+  return true;
+}
+
+bool DwarfFile::FindDieScope(uint64_t die_offset, uint32_t& scope)
+{
+  // The DIEs of its unit are indexed to find its parents
+  const Unit* unit = FindUnit(die_offset);
+  if (!unit) {
+    return false;
+  }
+  uint32_t unit_index = unit - units_.data();
+  const std::vector<DieIndexEntry>& dies = UnitDies(unit_index);
+  const DieIndexEntry* die = FindDie(dies, die_offset);
+  unit_ = *unit;
+  if (!die || !LoadAbbrevTags(unit_)) {
+    return false;
+  }
+  return DecodeWithUnitFormat(unit_, [&](auto format) {
+    typedef decltype(format) Format;
+    ReadUnitBases<Format>(unit_.dies, unit_.end - unit_.dies);
+    scope = DieScope<Format>(dies, die - dies.data());
+    return true;
+  });
+}
+
+bool DwarfFile::IsDieInScope(uint64_t die_offset, const std::string& scope_name)
+{
+  uint32_t scope = TreeBuilder::kLocalScope;
+  return FindDieScope(die_offset, scope) && scope != TreeBuilder::kLocalScope && 
+         TypeIndex::MatchScopeName(tree_builder_.ScopeName(scope), scope_name);
+}
+
+bool DwarfFile::FindIndexedTypes(const std::string& name, const std::string* scope_name, 
+                                 const std::set<uint64_t>* unit_offsets, std::vector<uint64_t>& roots)
+{
+  if (!IndexUnits()) {
+    return false;
+  }
+
+  // Only the DIEs of the units searched are indexed, and only the names of
+  // the DIEs with a type tag are decoded
+  for (uint32_t unit_index = 0; unit_index < units_.size(); unit_index++) {
+    if (IsDuplicateTypeUnit(units_[unit_index]) || 
+        (unit_offsets && !unit_offsets->count(units_[unit_index].offset))) {
+      continue;
+    }
+    const std::vector<DieIndexEntry>& dies = UnitDies(unit_index);
+    if (dies.empty()) {
+      continue;
+    }
+    unit_ = units_[unit_index];
+    if (!LoadAbbrevTags(unit_)) {
+      return false;
+    }
+    DecodeWithUnitFormat(unit_, [&](auto format) {
+      ReadUnitBases<decltype(format)>(unit_.dies, unit_.end - unit_.dies);
+      return true;
+    });
+
+    for (size_t i = 0; i < dies.size(); i++) {
+      CompilationUnit::const_iterator it_section = compilation_unit_.find(dies[i].abbrev_code);
+      if (it_section == compilation_unit_.end() || 
+          !TreeBuilder::IsNamedType(TagElementType(it_section->second.type))) {
+        continue;
+      }
+
+      // The scope is only built for the DIEs with the name
+      bool found = false;
+      DecodeWithUnitFormat(unit_, [&](auto format) {
+        typedef decltype(format) Format;
+        char* die_name = DieName<Format>(dies[i]);
+        std::string die_scope_name;
+        found = die_name && name == die_name && 
+                (!scope_name || (DieScopeName<Format>(dies, i, die_scope_name) && 
+                                 TypeIndex::MatchScopeName(die_scope_name, *scope_name)));
+        return true;
+      });
+      if (found) {
+        roots.push_back(dies[i].offset);
+      }
+    }
+  }
+  return true;
+}
+
+bool DwarfFile::DieTag(uint64_t die_offset, Dwarf32::Tag& tag)
+{
+  const Unit* unit = FindUnit(die_offset);
+  if (!unit || !LoadAbbrevTags(*unit)) {
+    return false;
+  }
+
+  // Only the abbreviation code of the DIE is read
+  unsigned char* info = unit->begin + (die_offset - unit->offset);
+  size_t info_bytes = unit->end - info;
+  CompilationUnit::iterator it_section = compilation_unit_.find(DwarfFile::ULEB128(info, info_bytes));
+  if (it_section == compilation_unit_.end()) {
+    return false;
+  }
+  tag = it_section->second.type;
+  return true;
+}
+
+bool DwarfFile::FindAppleTypeRoots(DebugSection table, const std::string& name, const std::string* scope_name,
+                                   std::vector<uint64_t>& roots)
+{
+  const OptionalSection& apple_table = section(table);
+  AppleAccelTable accel_table(apple_table.data, apple_table.size, 
+                              reinterpret_cast<char*>(debug_str_), debug_str_size_);
+  std::vector<AppleAccelTable::Entry> entries;
+  if (!accel_table.Lookup(name.c_str(), entries)) {
+    return false;
+  }
+
+  for (const AppleAccelTable::Entry& entry : entries) {
+    // __apple_names has no DW_ATOM_die_tag, the tag is in the DIE
+    Dwarf32::Tag tag = static_cast<Dwarf32::Tag>(entry.tag);
+    if (!tag && !DieTag(entry.die_offset, tag)) {
+      continue;
+    }
+    if (TreeBuilder::IsNamedType(TagElementType(tag)) && 
+        (!scope_name || IsDieInScope(entry.die_offset, *scope_name))) {
+      roots.push_back(entry.die_offset);
+    }
+  }
+  return true;
+}
+
+bool DwarfFile::HasAcceleratorTable() const
+{
+  return section(DebugSection::names).data || section(DebugSection::apple_types).data || 
+         section(DebugSection::apple_names).data || section(DebugSection::gdb_index).data;
+}
+
+bool DwarfFile::FindTypeRoots(const std::string& type_name, std::vector<uint64_t>& roots)
+{
+  // The DIEs and the accelerator tables name the types without their scope,
+  // a qualified name only matches the DIEs of this scope
+  std::string scope_name;
+  std::string unqualified_name;
+  bool qualified = TypeIndex::SplitTypeName(type_name, scope_name, unqualified_name);
+
+  const OptionalSection& names = section(DebugSection::names);
+  if (names.data) {
+    DebugNames debug_names(names.data, names.size, reinterpret_cast<char*>(debug_str_), debug_str_size_);
+    std::vector<DebugNames::Entry> entries;
+    if (!debug_names.Lookup(unqualified_name.c_str(), entries)) {
+      return false;
+    }
+
+    for (const DebugNames::Entry& entry : entries) {
+      if (TreeBuilder::IsNamedType(TagElementType(static_cast<Dwarf32::Tag>(entry.tag))) && 
+          (!qualified || IsDieInScope(entry.die_offset, scope_name))) {
+        roots.push_back(entry.die_offset);
+      }
+    }
+    return true;
+  }
+
+  if (section(DebugSection::apple_types).data || section(DebugSection::apple_names).data) {
+    if (section(DebugSection::apple_types).data && 
+        !FindAppleTypeRoots(DebugSection::apple_types, unqualified_name, qualified ? &scope_name : nullptr, roots)) {
+      return false;
+    }
+    if (section(DebugSection::apple_names).data && 
+        !FindAppleTypeRoots(DebugSection::apple_names, unqualified_name, qualified ? &scope_name : nullptr, roots)) {
+      return false;
+    }
+    return true;
+  }
+
+  const OptionalSection& gdb_index = section(DebugSection::gdb_index);
+  if (gdb_index.data) {
+    // The index only gives the compilation units, parse them to find the DIEs
+    GdbIndex index(gdb_index.data, gdb_index.size);
+    std::vector<uint64_t> unit_offsets;
+    std::string index_name = type_name.compare(0, 2, "::") == 0 ? type_name.substr(2) : type_name;
+    if (!index.Lookup(index_name.c_str(), unit_offsets)) {
+      return false;
+    }
+    if (unit_offsets.empty()) {
+      return true;
+    }
 
-        if (tag_id >= 0x0ab78256 && tag_id < 0x0ab7835d) {
-          DBG_PRINTF(".info+%lx\t %02x %02x\n", 
-              info-reinterpret_cast<unsigned char*>(debug_info_), abbrev_attribute, abbrev_form);
+    std::set<uint64_t> units(unit_offsets.begin(), unit_offsets.end());
+    return FindIndexedTypes(unqualified_name, qualified ? &scope_name : nullptr, &units, roots);
+  }
+
+  // Without accelerator table, the names of all the types are read
+  return FindIndexedTypes(unqualified_name, qualified ? &scope_name : nullptr, nullptr, roots);
+}
+
+bool DwarfFile::FindType(const std::string& type_name)
+{
+  if (!is_loaded_) {
+    return false;
+  }
+
+  if (!HasAcceleratorTable()) {
+    fprintf(stderr, "No accelerator table, indexing all the DIEs\n");
+  }
+  std::vector<uint64_t> found;
+  if (!FindTypeRoots(type_name, found)) {
+    return false;
+  }
+  if (found.empty()) {
+    fprintf(stderr, "Type '%s' not found\n", type_name.c_str());
+    return false;
+  }
+
+  // Parse the DIEs and follow their type references until all of them are
+  // in the tree. Like MergeTypes, a declaration is replaced by the definition
+  // linked to it, or else by the definitions with its qualified name in its
+  // scope, so they are parsed too.
+  std::unordered_set<uint64_t> parsed;
+  std::unordered_set<uint64_t> nested;    // Parsed in the tree of another root
+  std::vector<uint64_t> roots;
+  std::set<std::pair<uint32_t, std::string>> declared;
+  std::vector<std::pair<uint32_t, const char*>> declarations;
+  std::vector<uint64_t> ids;
+  std::vector<uint64_t> pending(found);
+  while (!pending.empty()) {
+    while (!pending.empty()) {
+      uint64_t die_offset = pending.back();
+      pending.pop_back();
+      if (nested.count(die_offset) || !parsed.insert(die_offset).second) {
+        continue;
+      }
+
+      size_t first_element = tree_builder_.ElementCount();
+      if (!ParseDieTree(die_offset)) {
+        continue;
+      }
+      roots.push_back(die_offset);
+      tree_builder_.GetTypeReferences(first_element, pending);
+      tree_builder_.GetDeclarations(first_element, declarations);
+      ids.clear();
+      tree_builder_.GetElementIds(first_element, ids);
+      for (uint64_t id : ids) {
+        if (id != die_offset) {
+          nested.insert(id);
         }
+      }
+    }
 
-        bool logged = LogDwarfInfo(section->type, abbrev_attribute, tag_id, abbrev_form, info, info_bytes, unit_hdr);
-        if (!logged) {
-          DwarfFile::PassData(abbrev_form, info, info_bytes);
+    for (const std::pair<uint32_t, const char*>& declaration : declarations) {
+      if (!declared.emplace(declaration.first, declaration.second).second) {
+        continue;
+      }
+      std::vector<uint64_t> definitions;
+      const std::string& scope_name = tree_builder_.ScopeName(declaration.first);
+      if (!FindTypeRoots("::" + scope_name + (scope_name.empty() ? "" : "::") + declaration.second, 
+                         definitions)) {
+        return false;
+      }
+      // The anonymous namespaces of the other units have the same name
+      for (uint64_t definition : definitions) {
+        uint32_t scope = TreeBuilder::kLocalScope;
+        if (FindDieScope(definition, scope) && scope == declaration.first) {
+          pending.push_back(definition);
         }
       }
     }
+    declarations.clear();
   }
 
-  return false;
+  // The trees nested in another one are dropped, the others are parsed again
+  // in the order of the DIEs so that each element is only added once. Like in
+  // GetAllClasses, the copies of the types are removed unit by unit.
+  tree_builder_.DiscardElements(0);
+  std::sort(roots.begin(), roots.end());
+  const Unit* unit = nullptr;
+  size_t first_element = 0;
+  for (uint64_t root : roots) {
+    if (nested.count(root)) {
+      continue;
+    }
+    const Unit* root_unit = FindUnit(root);
+    if (root_unit != unit) {
+      tree_builder_.DeduplicateTypes(first_element, type_table_);
+      unit = root_unit;
+      first_element = tree_builder_.ElementCount();
+    }
+    ParseDieTree(root);
+  }
+  tree_builder_.DeduplicateTypes(first_element, type_table_);
+  tree_builder_.MergeTypes(&found);
+
+  // The other types of the trees parsed are not referenced by the types found
+  tree_builder_.KeepReferencedTypes(found);
+  return true;
 }
 
+template <typename Format>
+bool DwarfFile::ParseDies(unsigned char* &info, size_t& info_bytes, bool single_tree)
+{
+  // For all compilation tags
+  int depth = 0;
+  while (!malformed_ && info < unit_.end) {
+    uint64_t tag_id = unit_.offset + (info - unit_.begin);
+    uint32_t abbrev_num = DwarfFile::ULEB128(info, info_bytes);
 
+    DBG_PRINTF(".info+%lx\t Tag 0x%lx ; Info Number %d\n", info-reinterpret_cast<unsigned char*>(debug_info_), tag_id, abbrev_num);
+
+    if (!abbrev_num) { // Null DIE so end of the children list
+      tree_builder_.EndOfChildren();
+      depth--;
+      if (!scopes_.empty()) {
+        scopes_.pop_back();
+      }
+      if (single_tree && depth <= 0) {
+        break;
+      }
+      continue;
+    }
+
+    CompilationUnit::iterator it_section = compilation_unit_.find(abbrev_num);
+    if (it_section == compilation_unit_.end()) {
+      fprintf(stderr, "ERR at 0x%lx: Can't find compilation unit with abbrev number %d\n", 
+          unit_.offset + (info - unit_.begin), abbrev_num);
+      SetMalformed(info, info_bytes);
+      break;
+    }
+    TagSection* section = &it_section->second;
+    parsed_dies_++;
+
+    // The only bounds check of the fixed size attributes
+    if (section->fixed_size > info_bytes) {
+      SetMalformed(info, info_bytes);
+      break;
+    }
+
+    DBG_PRINTF("[%d] section->num = %d; section->type = 0x%x ; has_children = %d\n", depth, section->number, section->type, section->has_children);
+
+    // Register the new tag (class, structure, namespace, etc.). A filtered
+    // out DIE with children still opens a level of the tree.
+    if (section->wanted) {
+      RegisterNewTag(section->type, tag_id, section->has_children);
+    } else if (section->has_children) {
+      tree_builder_.AddFilteredLevel();
+    }
+
+    // Increment the depth for the next children 
+    if (section->has_children) {
+      depth++;
+    }
+
+    // For all attributes
+    die_name_ = nullptr;
+    die_declaration_ = false;
+    die_specification_ = 0;
+    die_signature_ = 0;
+    const std::vector<AttributeSpec>& attributes = section->attributes;
+    for (size_t i = 0; i < attributes.size();) {
+      const AttributeSpec& spec = attributes[i];
+      if (spec.skip_count) {
+        info += spec.skip_size;
+        info_bytes -= spec.skip_size;
+        i += spec.skip_count;
+        continue;
+      }
+      if (!spec.logged || !LogDwarfInfo<Format>(section->type, spec, tag_id, info, info_bytes)) {
+        DwarfFile::PassData<Format>(spec, info, info_bytes);
+      }
+      i++;
+    }
+
+    // ParseDieTree starts a single tree in the scope of its root
+    uint32_t scope = scopes_.empty() ? TreeBuilder::kGlobalScope : scopes_.back();
+    if (die_specification_) {
+      // A definition out of the scope of its declaration (a nested class
+      // defined outside of its class, the type DIE of a type unit) has the
+      // scope and the name of the declaration, so do its children
+      const Declaration* declaration = FindDeclaration(die_specification_);
+      if (declaration) {
+        scope = declaration->scope;
+        die_name_ = die_name_ ? die_name_ : declaration->name;
+      }
+    } else if (section->declarable && die_declaration_ && die_name_) {
+      unit_declarations_.push_back({tag_id, scope, die_name_});
+    }
+    // The stub of a type unit declaration may have no name, its link is
+    // enough to merge it
+    if (section->named_type && (die_name_ || die_signature_)) {
+      tree_builder_.SetElementScope(scope, die_name_, section->declarable, die_declaration_, 
+                                    die_specification_ ? die_specification_ : die_signature_);
+    }
+    if (section->has_children) {
+      scopes_.push_back(ChildrenScope(section->type, scope));
+    }
+
+    if (single_tree && depth == 0) {
+      break;    // DIE without children
+    }
+  }
+
+  return true;
+}
@@ -1,22 +1,83 @@
 #pragma once
 #include <string>
 #include <map>
+#include <memory>
+#include <set>
+#include <unordered_map>
 #include <vector>
 #include "dwarf32.h"
+#include "DwarfForm.h"
 #include "TreeBuilder.h"
+#include "UnitCache.h"
 
 
 class DwarfFile {
 public:
-  DwarfFile() : memfile_(0), is_loaded_(false) {};
-  ~DwarfFile() = default;
+  DwarfFile() : filesize_(0), memfile_(0), is_loaded_(false) {};
+  virtual ~DwarfFile() = default;
+
+  // Sections which are not required to dump the types
+  enum class DebugSection {
+    str_offsets,
+    line_str,
+    addr,
+    names,
+    gdb_index,
+    apple_names,
+    apple_types,
+    types,
+    count
+  };
 
   void SetDebugPointers(void* debug_info, size_t debug_info_size, 
                         void* debug_abbrev, size_t debug_abbrev_size, 
                         void* debug_str, size_t debug_str_size);
+  bool SetDebugSection(DebugSection section, void* data, size_t size);
 
+  // Only decode the DIEs of these tags and these attributes, empty for all
+  void SetFilter(const std::set<Dwarf32::Tag>& tags, const std::set<Dwarf32::Attribute>& attributes);
+  // Units dumped by GetAllClasses, selected by the attributes of their root
+  // DIE. The names and the producers are fnmatch patterns. A unit is dumped
+  // when it matches one of the patterns of each non empty list, and none of
+  // the excluded ones. The type units have no name and no producer, only
+  // their language is filtered.
+  struct UnitFilter {
+    std::vector<std::string> names;
+    std::vector<std::string> excluded_names;
+    std::vector<std::string> producers;
+    std::vector<std::string> excluded_producers;
+    std::set<Dwarf32::Language> languages;
+    std::set<Dwarf32::Language> excluded_languages;
+
+    bool empty() const {
+      return names.empty() && excluded_names.empty() && producers.empty() && 
+             excluded_producers.empty() && languages.empty() && excluded_languages.empty();
+    }
+  };
+  void SetUnitFilter(const UnitFilter& filter) { unit_filter_ = filter; }
+  // Threads parsing the units in GetAllClasses, 0 to choose them from a
+  // sample of the units
+  void SetThreadCount(unsigned thread_count) { thread_count_ = thread_count; }
+  // Print how the units are parsed on stderr
+  void SetVerbose(bool verbose) { verbose_ = verbose; }
+  // Keep the elements of each unit in directory, the units which didn't
+  // change are not parsed again by GetAllClasses
+  bool SetCacheDirectory(const std::string& directory);
+
+  // False if the headers of some units can't be read, the units before the
+  // malformed one are still parsed
   bool GetAllClasses();
-  std::string json() { return tree_builder_.GenerateJson(); }
+  // Parse a uniform random sample of percent % of the units, the same for the
+  // same binary, and extrapolate the statistics of their types to all the
+  // units (see TypeStatistics)
+  bool SampleTypes(double percent, std::string& statistics);
+  // Parse only the types named type_name and the types they reference
+  bool FindType(const std::string& type_name);
+  std::string json(const TreeBuilder::JsonOptions& options = TreeBuilder::JsonOptions()) {
+    return tree_builder_.GenerateJson(options);
+  }
+  // Write the types found in an index file, see TypeIndex
+  bool WriteIndex(const std::string& path);
 
 
 protected:
@@ -25,17 +86,183 @@ protected:
   bool is_loaded_;
 
   bool IsValidFilePtr(void* ptr, size_t size = 0);
+  bool MapFile(const std::string& filepath);
+  void UnmapFile();
 
 
 private:
-  static uint32_t ULEB128(unsigned char* &data, size_t& bytes_available);
-  static void PassData(Dwarf32::Form form, unsigned char* &data, size_t& bytes_available);
-  uint64_t FormDataValue(Dwarf32::Form form, unsigned char* &info, size_t& bytes_available);
-  char* FormStringValue(Dwarf32::Form form, unsigned char* &info, size_t& bytes_available);
-  bool LoadAbbrevTags(uint32_t abbrev_offset);
+  struct AttributeSpec {
+    Dwarf32::Attribute attribute;
+    Dwarf32::Form form;
+    int64_t implicit_const;   // Only for DW_FORM_implicit_const
+    uint32_t fixed_size_after; // Size of the fixed parts of the next attributes
+    bool logged;              // Decoded by LogDwarfInfo, otherwise skipped
+    bool output;              // Passed to the tree, not only read for the scopes
+    uint32_t skip_count;      // Number of consecutive fixed size attributes to
+    uint32_t skip_size;       // skip from this one, and their size
+  };
+
+  // Abbreviation of the DIEs
+  struct TagSection {
+    unsigned int number;
+    Dwarf32::Tag type;
+    bool has_children;
+    uint32_t fixed_size;      // Size of the fixed parts of all the attributes
+    bool fixed_size_only;     // The DIE size is fixed_size
+    bool wanted;              // The tag passes the filter
+    bool named_type;          // Wanted type with a qualified name
+    bool declarable;          // Wanted type which can be a declaration
+    std::vector<AttributeSpec> attributes;
+  };
+
+  struct Unit {
+    unsigned char* section;   // .debug_info or .debug_types
+    uint64_t offset;          // Identifier of the unit header, the ones of its
+                              // DIEs follow (offset + DIE position in the unit)
+    unsigned char* begin;     // Unit header
+    unsigned char* dies;      // First DIE after the header
+    unsigned char* end;
+    uint16_t version;
+    uint8_t unit_type;
+    uint8_t address_size;
+    uint8_t offset_size;      // 4 for DWARF32, 8 for DWARF64
+    uint64_t abbrev_offset;
+    uint64_t str_offsets_base;
+    uint64_t addr_base;
+    uint64_t type_signature;  // Type units only
+    uint64_t type_offset;
+  };
+
+  // Compact description of a DIE, enough to decode it later
+  struct DieIndexEntry {
+    uint64_t offset;          // Identifier of the DIE
+    uint32_t abbrev_code;
+    uint32_t parent;          // Index of the parent DIE, its own for the root DIE
+  };
+
+  // How GetAllClasses parses the units
+  struct ParsePlan {
+    unsigned threads;         // 1 to parse them in the calling thread
+    uint64_t chunk_bytes;     // Size of the consecutive units parsed by a task
+    uint32_t prefetch_chunks; // Chunks read ahead of the ones being parsed
+    bool prefetch_strings;    // .debug_str is read ahead at once
+  };
+
+  // DIEs of the units sampled to choose the ParsePlan
+  struct UnitSample {
+    uint64_t units;
+    uint64_t bytes;
+    uint64_t dies;
+    uint64_t skipped_dies;    // Filtered out, their attributes are skipped
+    uint64_t strings;         // Decoded strings
+    uint64_t section_strings; // Decoded strings read in another section
+  };
+
+  // Attributes of the root DIE of a unit, read by the unit filter
+  struct UnitRoot {
+    const char* name;
+    const char* producer;
+    uint64_t language;
+    bool has_language;
+  };
+
+  // Raw value of an attribute
+  struct FormValue {
+    uint64_t value;           // Constant, offset, index or length of a block
+    unsigned char* data;      // Inline string or data of a block
+    DwarfForm::Kind kind;
+  };
+
+  static uint64_t ULEB128(unsigned char* &data, size_t& bytes_available);
+  static int64_t SLEB128(unsigned char* &data, size_t& bytes_available);
+  static size_t InlineStringSize(const unsigned char* data, size_t bytes_available);
+
+  // The templated methods take the DwarfForm::UnitFormat of the unit, which
+  // gives the size of its offsets and addresses
+  template <typename Decoder>
+  bool DecodeWithUnitFormat(const Unit& unit, Decoder decode);
+  template <typename Format>
+  FormValue ReadForm(const AttributeSpec& spec, unsigned char* &info, size_t& bytes_available);
+  void SetMalformed(unsigned char* &info, size_t& bytes_available);
+  template <typename Format>
+  void PassData(const AttributeSpec& spec, unsigned char* &data, size_t& bytes_available);
+  template <typename Format>
+  uint64_t FormDataValue(const AttributeSpec& spec, unsigned char* &info, size_t& bytes_available);
+  template <typename Format>
+  uint64_t FormReferenceValue(const AttributeSpec& spec, unsigned char* &info, size_t& bytes_available);
+  template <typename Format>
+  char* FormStringValue(const AttributeSpec& spec, unsigned char* &info, size_t& bytes_available);
+  template <typename Format>
+  char* StringValue(const AttributeSpec& spec, const FormValue& form_value);
+  template <typename Format>
+  char* IndexedString(uint64_t index);
+  template <typename Format>
+  uint64_t IndexedAddress(uint64_t index);
+  bool ReadUnitHeader(unsigned char* info, size_t info_bytes, Unit& unit);
+  template <typename Hdr, typename Hdr5>
+  bool ReadUnitHeaderFields(unsigned char* info, size_t info_bytes, Unit& unit);
+  template <typename Format>
+  void ReadUnitBases(unsigned char* info, size_t info_bytes);
+  bool ReadAbbrev(const Unit& unit, unsigned char* &abbrev, size_t& abbrev_bytes, TagSection& section);
+  bool LoadAbbrevTags(const Unit& unit);
+  bool IsUnitWanted(const Unit& unit);
+  template <typename Format>
+  bool ReadUnitRoot(const TagSection& root, UnitRoot& root_attributes);
+  ParsePlan PlanParsing(const std::vector<const Unit*>& units);
+  template <typename Format>
+  void SampleUnitDies(UnitSample& sample);
+  void ParseUnitsInParallel(const std::vector<const Unit*>& units, const ParsePlan& plan);
+  std::unique_ptr<DwarfFile> NewWorker() const;
+  void Prefetch(const void* data, size_t size) const;
+  bool ParseUnit(const Unit& unit);
+  // Keys of the unit in the cache, 0 if it can't be cached: UnitHash hashes
+  // its bytes without decoding the DIEs, UnitContentHash decodes them to hash
+  // their strings by content, the same when only the string offsets moved
+  uint64_t UnitHeaderHash() const;
+  uint64_t UnitHash();
+  uint64_t UnitContentHash();
+  template <typename Format>
+  void HashUnitDies(uint64_t& hash);
+  bool LoadCachedUnit(uint64_t key, bool check_strings);
+  bool CheckCachedStrings(std::vector<char>& data) const;
+  void IndexTypeDieSignatures();
+  void StoreCachedUnit(uint64_t key, uint64_t content_key, size_t first_element);
+  bool ParseDieTree(uint64_t die_offset);
+  template <typename Format>
+  bool ParseDies(unsigned char* &info, size_t& info_bytes, bool single_tree);
+  bool IndexUnits();
+  bool IndexUnitsOfSection(unsigned char* section, size_t section_size, uint64_t id_base);
+  bool IsDuplicateTypeUnit(const Unit& unit) const;
+  const Unit* FindUnit(uint64_t die_offset);
+  const std::vector<DieIndexEntry>& UnitDies(uint32_t unit_index);
+  template <typename Format>
+  bool IndexUnitDies(const Unit& unit, std::vector<DieIndexEntry>& dies);
+  static const DieIndexEntry* FindDie(const std::vector<DieIndexEntry>& dies, uint64_t die_offset);
+  template <typename Format>
+  char* DieName(const DieIndexEntry& die, uint64_t* specification = nullptr);
+  template <typename Format>
+  uint32_t DieScope(const std::vector<DieIndexEntry>& dies, size_t die);
+  template <typename Format>
+  bool DieScopeName(const std::vector<DieIndexEntry>& dies, size_t die, std::string& scope_name);
+  bool FindDieScope(uint64_t die_offset, uint32_t& scope);
+  bool IsDieInScope(uint64_t die_offset, const std::string& scope_name);
+  bool FindIndexedTypes(const std::string& name, const std::string* scope_name, 
+                        const std::set<uint64_t>* unit_offsets, std::vector<uint64_t>& roots);
+  bool DieTag(uint64_t die_offset, Dwarf32::Tag& tag);
+  bool FindAppleTypeRoots(DebugSection table, const std::string& name, const std::string* scope_name,
+                          std::vector<uint64_t>& roots);
+  bool HasAcceleratorTable() const;
+  bool FindTypeRoots(const std::string& type_name, std::vector<uint64_t>& roots);
+  static TreeBuilder::ElementType TagElementType(Dwarf32::Tag tag);
+  static bool IsLoggedAttribute(Dwarf32::Attribute attribute);
+  static bool IsScopeTag(Dwarf32::Tag tag);
+  uint32_t ChildrenScope(Dwarf32::Tag tag, uint32_t scope);
+  struct Declaration;
+  const Declaration* FindDeclaration(uint64_t die_offset) const;
   void RegisterNewTag(Dwarf32::Tag tag, uint64_t tag_id, bool has_children);
-  bool LogDwarfInfo(Dwarf32::Tag tag, Dwarf32::Attribute attribute,  uint64_t tag_id, Dwarf32::Form form, 
-                    unsigned char* &info, size_t& info_bytes, void* unit_base);
+  template <typename Format>
+  bool LogDwarfInfo(Dwarf32::Tag tag, const AttributeSpec& spec, uint64_t tag_id,
+                    unsigned char* &info, size_t& info_bytes);
 
   void* debug_info_;
   size_t debug_info_size_;
@@ -44,14 +271,58 @@ private:
   void* debug_str_;
   size_t debug_str_size_;
 
-  struct TagSection {
-      unsigned int number;
-      Dwarf32::Tag type;
-      bool has_children;
-      unsigned char* ptr;
+  struct OptionalSection {
+    unsigned char* data;
+    size_t size;
   };
+  OptionalSection sections_[static_cast<size_t>(DebugSection::count)] = {};
+  const OptionalSection& section(DebugSection id) const {
+    return sections_[static_cast<size_t>(id)];
+  }
+
   typedef std::map<unsigned int, struct TagSection> CompilationUnit;
   CompilationUnit compilation_unit_;
+  uint64_t compilation_unit_offset_ = 0; // Abbreviation offset of compilation_unit_
+  uint32_t compilation_unit_format_ = 0; // Sizes used for the fixed sizes of compilation_unit_
+  uint64_t compilation_unit_hash_ = 0;  // Hash of the abbreviations of compilation_unit_
+  bool malformed_ = false;              // The unit being decoded is truncated or invalid
+  std::vector<unsigned char> malformed_sink_;
+  std::set<Dwarf32::Tag> tag_filter_;
+  std::set<Dwarf32::Attribute> attribute_filter_;
+  uint64_t filter_hash_ = 0;
+  UnitFilter unit_filter_;
+  unsigned thread_count_ = 0;
+  bool verbose_ = false;
+
+  // Scopes of the children of the DIEs being parsed, the scope of the next
+  // DIE is the last one
+  std::vector<uint32_t> scopes_;
+  const char* die_name_ = nullptr;      // DW_AT_name of the DIE being parsed
+  bool die_declaration_ = false;        // DW_AT_declaration of the DIE being parsed
+  uint64_t die_specification_ = 0;      // DW_AT_specification of the DIE being parsed
+  uint64_t die_signature_ = 0;          // Type DIE of the DW_AT_signature of the DIE being parsed
+  // Named type declarations of the unit being parsed, in the order of their
+  // offsets, for the definitions out of their scope (DW_AT_specification)
+  struct Declaration {
+    uint64_t offset;
+    uint32_t scope;
+    const char* name;
+  };
+  std::vector<Declaration> unit_declarations_;
+  Unit unit_;                           // Unit being parsed
+  uint64_t parsed_dies_ = 0;            // DIEs parsed by ParseDies, for --verbose
+  uint64_t die_heap_allocations_ = 0;   // Made by the arena of tree_builder_ to store them
+  std::vector<Unit> units_;             // Headers of all the units, sorted by offset
+  bool units_indexed_ = false;
+  std::unordered_map<uint64_t, uint64_t> type_signatures_;  // Signature to type DIE
+  // DIEs of each unit of units_, sorted by offset, indexed on demand by
+  // UnitDies
+  std::vector<std::vector<DieIndexEntry>> unit_dies_;
+  std::vector<bool> unit_dies_indexed_;
+
+  std::unique_ptr<UnitCache> unit_cache_;
+  std::unordered_map<uint64_t, uint64_t> type_die_signatures_;  // Type DIE to signature, for the cache
 
+  TypeTable type_table_;                  // Canonical types of all the units
   TreeBuilder tree_builder_;
 };
@@ -0,0 +1,185 @@
+#pragma once
+#include <stdint.h>
+#include "dwarf32.h"
+
+// Encoding of the attribute forms. All the forms are decoded by the same
+// routine, driven by their descriptor.
+namespace DwarfForm {
+  // How the size of the data is known
+  enum class Size : uint8_t {
+    invalid,        // Unknown form
+    none,           // No data in the DIE
+    fixed,          // fixed_size bytes
+    offset,         // Offset size of the unit (4 or 8 bytes)
+    address,        // Address size of the unit
+    ref_addr,       // Address size in DWARF 2, offset size since DWARF 3
+    uleb128,
+    sleb128,
+    block,          // ULEB128 length followed by the data
+    block1,         // 1 byte length followed by the data
+    block2,         // 2 bytes length followed by the data
+    block4,         // 4 bytes length followed by the data
+    string,         // NUL terminated string
+    indirect        // ULEB128 form followed by the data of this form
+  };
+
+  // What the value means
+  enum class Kind : uint8_t {
+    none,
+    constant,
+    flag,
+    address,
+    address_index,      // Index in .debug_addr
+    block,              // The value is the length of the block
+    reference,          // Offset relative to the unit
+    global_reference,   // Offset in .debug_info
+    signature,          // Signature of a type unit
+    supplementary,      // Reference or string in a supplementary object file
+    section_offset,
+    list_index,         // Index in the location or range lists
+    string_offset,      // Offset in .debug_str
+    line_string_offset, // Offset in .debug_line_str
+    string_index,       // Index in .debug_str_offsets
+    inline_string
+  };
+
+  struct Descriptor {
+    Size size;
+    uint8_t fixed_size;   // Only for Size::fixed
+    Kind kind;
+  };
+
+  // Indexed by form, from 0 to DW_FORM_addrx4
+  constexpr Descriptor kForms[] = {
+    {Size::invalid, 0, Kind::none},                   // 0x00
+    {Size::address, 0, Kind::address},                // DW_FORM_addr
+    {Size::invalid, 0, Kind::none},                   // 0x02
+    {Size::block2, 0, Kind::block},                   // DW_FORM_block2
+    {Size::block4, 0, Kind::block},                   // DW_FORM_block4
+    {Size::fixed, 2, Kind::constant},                 // DW_FORM_data2
+    {Size::fixed, 4, Kind::constant},                 // DW_FORM_data4
+    {Size::fixed, 8, Kind::constant},                 // DW_FORM_data8
+    {Size::string, 0, Kind::inline_string},           // DW_FORM_string
+    {Size::block, 0, Kind::block},                    // DW_FORM_block
+    {Size::block1, 0, Kind::block},                   // DW_FORM_block1
+    {Size::fixed, 1, Kind::constant},                 // DW_FORM_data1
+    {Size::fixed, 1, Kind::flag},                     // DW_FORM_flag
+    {Size::sleb128, 0, Kind::constant},               // DW_FORM_sdata
+    {Size::offset, 0, Kind::string_offset},           // DW_FORM_strp
+    {Size::uleb128, 0, Kind::constant},               // DW_FORM_udata
+    {Size::ref_addr, 0, Kind::global_reference},      // DW_FORM_ref_addr
+    {Size::fixed, 1, Kind::reference},                // DW_FORM_ref1
+    {Size::fixed, 2, Kind::reference},                // DW_FORM_ref2
+    {Size::fixed, 4, Kind::reference},                // DW_FORM_ref4
+    {Size::fixed, 8, Kind::reference},                // DW_FORM_ref8
+    {Size::uleb128, 0, Kind::reference},              // DW_FORM_ref_udata
+    {Size::indirect, 0, Kind::none},                  // DW_FORM_indirect
+    {Size::offset, 0, Kind::section_offset},          // DW_FORM_sec_offset
+    {Size::block, 0, Kind::block},                    // DW_FORM_exprloc
+    {Size::none, 0, Kind::flag},                      // DW_FORM_flag_present
+    {Size::uleb128, 0, Kind::string_index},           // DW_FORM_strx
+    {Size::uleb128, 0, Kind::address_index},          // DW_FORM_addrx
+    {Size::fixed, 4, Kind::supplementary},            // DW_FORM_ref_sup4
+    {Size::offset, 0, Kind::supplementary},           // DW_FORM_strp_sup
+    {Size::fixed, 16, Kind::constant},                // DW_FORM_data16
+    {Size::offset, 0, Kind::line_string_offset},      // DW_FORM_line_strp
+    {Size::fixed, 8, Kind::signature},                // DW_FORM_ref_sig8
+    {Size::none, 0, Kind::constant},                  // DW_FORM_implicit_const
+    {Size::uleb128, 0, Kind::list_index},             // DW_FORM_loclistx
+    {Size::uleb128, 0, Kind::list_index},             // DW_FORM_rnglistx
+    {Size::fixed, 8, Kind::supplementary},            // DW_FORM_ref_sup8
+    {Size::fixed, 1, Kind::string_index},             // DW_FORM_strx1
+    {Size::fixed, 2, Kind::string_index},             // DW_FORM_strx2
+    {Size::fixed, 3, Kind::string_index},             // DW_FORM_strx3
+    {Size::fixed, 4, Kind::string_index},             // DW_FORM_strx4
+    {Size::fixed, 1, Kind::address_index},            // DW_FORM_addrx1
+    {Size::fixed, 2, Kind::address_index},            // DW_FORM_addrx2
+    {Size::fixed, 3, Kind::address_index},            // DW_FORM_addrx3
+    {Size::fixed, 4, Kind::address_index},            // DW_FORM_addrx4
+  };
+  constexpr uint32_t kFormCount = sizeof(kForms) / sizeof(kForms[0]);
+
+  static_assert(kFormCount == Dwarf32::Form::DW_FORM_addrx4 + 1, "Missing form descriptors");
+  static_assert(kForms[Dwarf32::Form::DW_FORM_flag_present].size == Size::none, "flag_present has no data");
+  static_assert(kForms[Dwarf32::Form::DW_FORM_ref_sig8].kind == Kind::signature, "Misplaced descriptor");
+  static_assert(kForms[Dwarf32::Form::DW_FORM_implicit_const].size == Size::none, "Misplaced descriptor");
+
+  constexpr Descriptor Describe(Dwarf32::Form form) {
+    if (form < kFormCount) {
+      return kForms[form];
+    }
+    switch (form) {
+      case Dwarf32::Form::DW_FORM_GNU_addr_index:
+        return {Size::uleb128, 0, Kind::address_index};
+      case Dwarf32::Form::DW_FORM_GNU_str_index:
+        return {Size::uleb128, 0, Kind::string_index};
+      case Dwarf32::Form::DW_FORM_GNU_ref_alt:
+      case Dwarf32::Form::DW_FORM_GNU_strp_alt:
+        return {Size::offset, 0, Kind::supplementary};
+      default:
+        return kForms[0];
+    }
+  }
+
+  // Size of the part of the data which doesn't depend on the data itself: all
+  // the data of the fixed size forms, the length field of the blocks. The
+  // other forms (LEB128, strings, blocks) have a variable part.
+  constexpr uint8_t FixedPartSize(Descriptor descriptor, uint8_t offset_size, uint8_t address_size, 
+                                  uint8_t ref_addr_size) {
+    switch (descriptor.size) {
+      case Size::fixed:
+        return descriptor.fixed_size;
+      case Size::offset:
+        return offset_size;
+      case Size::address:
+        return address_size;
+      case Size::ref_addr:
+        return ref_addr_size;
+      case Size::block1:
+        return 1;
+      case Size::block2:
+        return 2;
+      case Size::block4:
+        return 4;
+      default:
+        return 0;
+    }
+  }
+
+  // True when all the data of the form has a fixed size
+  constexpr bool IsFixedSize(Descriptor descriptor) {
+    return descriptor.size == Size::none || descriptor.size == Size::fixed || 
+           descriptor.size == Size::offset || descriptor.size == Size::address || 
+           descriptor.size == Size::ref_addr;
+  }
+
+  // Widths of the forms which depend on the unit header. They are the same for
+  // all the DIEs of a unit, so its decoder is instantiated for them. The
+  // version only matters for DW_FORM_ref_addr.
+  template <typename OffsetType, uint8_t address_size, bool dwarf2>
+  struct UnitFormat {
+    typedef OffsetType Offset;
+    static constexpr uint8_t kAddressSize = address_size;
+    static constexpr uint8_t kRefAddrSize = dwarf2 ? address_size : sizeof(OffsetType);
+
+    static constexpr uint8_t FixedPartSize(Descriptor descriptor) {
+      return DwarfForm::FixedPartSize(descriptor, sizeof(OffsetType), kAddressSize, kRefAddrSize);
+    }
+  };
+
+  // Little endian value of 1 to 8 bytes, the low 64 bits of longer ones
+  inline uint64_t ReadUnsigned(const unsigned char* data, uint8_t size) {
+    switch (size) {
+      case 1:
+        return *data;
+      case 2:
+        return *reinterpret_cast<const uint16_t*>(data);
+      case 3:
+        return data[0] | (data[1] << 8) | (data[2] << 16);
+      case 4:
+        return *reinterpret_cast<const uint32_t*>(data);
+      default:
+        return *reinterpret_cast<const uint64_t*>(data);
+    }
+  }
+};
@@ -7,53 +7,43 @@
 
 
 ElfFile::~ElfFile() {
-  if (memfile_) {
-    free(memfile_);
-  }
+  UnmapFile();
 }
 
 bool ElfFile::Load(std::string filepath) 
 {
-  if (is_loaded_) {
-    free(memfile_);
-    memfile_ = nullptr;
-  }
-  is_loaded_ = false;
-
-  // Copy the file in memory
-  FILE* hfile = fopen(filepath.c_str(), "rb");
-  if (!hfile) {
-    fprintf(stderr, "ERR: Failed to open '%s'\n", filepath.c_str());
+  if (!MapFile(filepath)) {
     return false;
   }
 
-  fseek(hfile, 0, SEEK_END);
-  filesize_ = ftell(hfile);
-  fseek(hfile, 0, SEEK_SET);
-  DBG_PRINTF("Target file size: 0x%lx\n", filesize_);
-
-  memfile_ = reinterpret_cast<unsigned char*>(malloc(filesize_));
-  size_t nb_read = fread(memfile_, filesize_, 1, hfile);
-  fclose(hfile);
-  if (nb_read != 1) {
-    fprintf(stderr, "ERR: Failed to read '%s'\n", filepath.c_str());
+  // The 32-bit targets have their own header layout
+  if (!IsValidFilePtr(memfile_, EI_NIDENT)) {
+    fprintf(stderr, "ERR: Invalid file header\n");
     return false;
   }
+  if (memfile_[EI_CLASS] == ELFCLASS32) {
+    return LoadSections<Elf32_Ehdr, Elf32_Phdr, Elf32_Shdr>();
+  }
+  return LoadSections<Elf64_Ehdr, Elf64_Phdr, Elf64_Shdr>();
+}
 
+template <typename Ehdr, typename Phdr, typename Shdr>
+bool ElfFile::LoadSections()
+{
   // Get the headers pointers
-  Elf64_Ehdr* file_header_ = reinterpret_cast<Elf64_Ehdr*>(memfile_);
+  Ehdr* file_header_ = reinterpret_cast<Ehdr*>(memfile_);
   if (!IsValidFilePtr(file_header_)) {
     fprintf(stderr, "ERR: Invalid file header\n");
     return false;
   } 
 
-  Elf64_Phdr* program_header_ = reinterpret_cast<Elf64_Phdr*>(memfile_ + file_header_->e_phoff);
+  Phdr* program_header_ = reinterpret_cast<Phdr*>(memfile_ + file_header_->e_phoff);
   if (!IsValidFilePtr(program_header_)) {
     fprintf(stderr, "ERR: Invalid program header\n");
     return false;
   }
 
-  Elf64_Shdr* section_header_ = reinterpret_cast<Elf64_Shdr*>(memfile_ + file_header_->e_shoff);
+  Shdr* section_header_ = reinterpret_cast<Shdr*>(memfile_ + file_header_->e_shoff);
   if (!IsValidFilePtr(section_header_)) {
     fprintf(stderr, "ERR: Invalid section header\n");
     return false;
@@ -83,6 +73,22 @@ bool ElfFile::Load(std::string filepath)
     } else if (!strcmp(name, ".debug_str")) {
       debug_str = reinterpret_cast<char*>(memfile_ + section_header_[i].sh_offset);
       debug_str_size = section_header_[i].sh_size;
+    } else if (!strcmp(name, ".debug_str_offsets")) {
+      SetDebugSection(DebugSection::str_offsets, memfile_ + section_header_[i].sh_offset, section_header_[i].sh_size);
+    } else if (!strcmp(name, ".debug_line_str")) {
+      SetDebugSection(DebugSection::line_str, memfile_ + section_header_[i].sh_offset, section_header_[i].sh_size);
+    } else if (!strcmp(name, ".debug_addr")) {
+      SetDebugSection(DebugSection::addr, memfile_ + section_header_[i].sh_offset, section_header_[i].sh_size);
+    } else if (!strcmp(name, ".debug_names")) {
+      SetDebugSection(DebugSection::names, memfile_ + section_header_[i].sh_offset, section_header_[i].sh_size);
+    } else if (!strcmp(name, ".gdb_index")) {
+      SetDebugSection(DebugSection::gdb_index, memfile_ + section_header_[i].sh_offset, section_header_[i].sh_size);
+    } else if (!strcmp(name, ".apple_names")) {
+      SetDebugSection(DebugSection::apple_names, memfile_ + section_header_[i].sh_offset, section_header_[i].sh_size);
+    } else if (!strcmp(name, ".apple_types")) {
+      SetDebugSection(DebugSection::apple_types, memfile_ + section_header_[i].sh_offset, section_header_[i].sh_size);
+    } else if (!strcmp(name, ".debug_types")) {
+      SetDebugSection(DebugSection::types, memfile_ + section_header_[i].sh_offset, section_header_[i].sh_size);
     }
   }
 
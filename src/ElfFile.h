@@ -7,4 +7,8 @@ public:
   ElfFile() = default;
   ~ElfFile();
   bool Load(std::string filepath);
+
+private:
+  template <typename Ehdr, typename Phdr, typename Shdr>
+  bool LoadSections();
 };
@@ -0,0 +1,107 @@
+#include "GdbIndex.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+
+namespace {
+  struct GdbIndexHdr {
+    uint32_t version;
+    uint32_t cu_list_offset;
+    uint32_t types_cu_list_offset;
+    uint32_t address_area_offset;
+    uint32_t symbol_table_offset;
+    uint32_t constant_pool_offset;
+  };
+
+  // Entries of the CU vectors
+  const uint32_t kCuIndexMask = 0x00ffffff;
+  const uint32_t kSymbolKindShift = 28;
+  const uint32_t kSymbolKindMask = 0x7;
+  const uint32_t kSymbolKindNone = 0;
+  const uint32_t kSymbolKindType = 1;
+}
+
+// static
+uint32_t GdbIndex::Hash(const char* name, uint32_t version) {
+  uint32_t hash = 0;
+  for (const unsigned char* c = reinterpret_cast<const unsigned char*>(name); *c; c++) {
+    unsigned char value = (version >= 5) ? tolower(*c) : *c;
+    hash = hash * 67 + value - 113;
+  }
+  return hash;
+}
+
+bool GdbIndex::Lookup(const char* name, std::vector<uint64_t>& unit_offsets) const {
+  if (size_ < sizeof(GdbIndexHdr)) {
+    return false;
+  }
+
+  const GdbIndexHdr* header = reinterpret_cast<const GdbIndexHdr*>(data_);
+  if (header->version < 7 || header->version > 8) {
+    fprintf(stderr, "ERR: Unsupported .gdb_index version %d\n", header->version);
+    return false;
+  }
+  if (header->cu_list_offset > header->types_cu_list_offset || 
+      header->symbol_table_offset > header->constant_pool_offset || 
+      header->constant_pool_offset > size_) {
+    fprintf(stderr, "ERR: Invalid .gdb_index header\n");
+    return false;
+  }
+
+  // The CU list is an array of (offset, length) in .debug_info
+  const uint64_t* cu_list = reinterpret_cast<const uint64_t*>(data_ + header->cu_list_offset);
+  uint32_t cu_count = (header->types_cu_list_offset - header->cu_list_offset) / (2 * sizeof(uint64_t));
+
+  // The symbol table is an open addressing hash table of (name, CU vector)
+  // offsets in the constant pool, its size is a power of 2
+  const uint32_t* symbols = reinterpret_cast<const uint32_t*>(data_ + header->symbol_table_offset);
+  uint32_t symbol_count = (header->constant_pool_offset - header->symbol_table_offset) / (2 * sizeof(uint32_t));
+  const unsigned char* constant_pool = data_ + header->constant_pool_offset;
+  size_t constant_pool_size = size_ - header->constant_pool_offset;
+  if (!symbol_count || (symbol_count & (symbol_count - 1))) {
+    return false;
+  }
+
+  uint32_t hash = GdbIndex::Hash(name, header->version);
+  uint32_t mask = symbol_count - 1;
+  uint32_t index = hash & mask;
+  uint32_t step = ((hash * 17) & mask) | 1;
+
+  for (uint32_t probe = 0; probe < symbol_count; probe++) {
+    uint32_t name_offset = symbols[2*index];
+    uint32_t cu_vector_offset = symbols[2*index + 1];
+    if (!name_offset && !cu_vector_offset) {
+      return true;    // Empty slot, the name is not in the table
+    }
+
+    if (name_offset < constant_pool_size && 
+        !strncmp(reinterpret_cast<const char*>(constant_pool + name_offset), name, 
+                 constant_pool_size - name_offset)) {
+      if (cu_vector_offset + sizeof(uint32_t) > constant_pool_size) {
+        return false;
+      }
+      const uint32_t* cu_vector = reinterpret_cast<const uint32_t*>(constant_pool + cu_vector_offset);
+      uint32_t count = cu_vector[0];
+      if (cu_vector_offset + (1 + static_cast<uint64_t>(count)) * sizeof(uint32_t) > constant_pool_size) {
+        return false;
+      }
+
+      for (uint32_t i = 1; i <= count; i++) {
+        uint32_t kind = (cu_vector[i] >> kSymbolKindShift) & kSymbolKindMask;
+        uint32_t cu_index = cu_vector[i] & kCuIndexMask;
+        if (kind != kSymbolKindNone && kind != kSymbolKindType) {
+          continue;
+        }
+        if (cu_index < cu_count) {   // The type units follow the CUs
+          unit_offsets.push_back(cu_list[2*cu_index]);
+        }
+      }
+      return true;
+    }
+
+    index = (index + step) & mask;
+  }
+
+  return true;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+
+// Reader of the symbol table of the .gdb_index section generated by the
+// linkers (--gdb-index) or gdb-add-index. It only gives the compilation units
+// defining a symbol, not the DIE.
+class GdbIndex {
+public:
+  GdbIndex(const unsigned char* data, size_t size) : data_(data), size_(size) {}
+
+  // Append the .debug_info offsets of the compilation units defining name.
+  // The name must be qualified (namespace::Class).
+  bool Lookup(const char* name, std::vector<uint64_t>& unit_offsets) const;
+
+  static uint32_t Hash(const char* name, uint32_t version);
+
+
+private:
+  const unsigned char* data_;
+  size_t size_;
+};
@@ -21,36 +21,12 @@ typedef int	cpu_subtype_t;
 #endif
 
 MachOFile::~MachOFile() {
-  if (memfile_) {
-    free(memfile_);
-  }
+  UnmapFile();
 }
 
 bool MachOFile::Load(std::string filepath, std::string target_arch) 
 {
-  if (is_loaded_) {
-    free(memfile_);
-    memfile_ = nullptr;
-  }
-  is_loaded_ = false;
-
-  // Copy the file in memory
-  FILE* hfile = fopen(filepath.c_str(), "rb");
-  if (!hfile) {
-    fprintf(stderr, "ERR: Failed to open '%s'\n", filepath.c_str());
-    return false;
-  }
-
-  fseek(hfile, 0, SEEK_END);
-  filesize_ = ftell(hfile);
-  fseek(hfile, 0, SEEK_SET);
-  DBG_PRINTF("Target file size: 0x%lx\n", filesize_);
-
-  memfile_ = reinterpret_cast<unsigned char*>(malloc(filesize_));
-  size_t nb_read = fread(memfile_, filesize_, 1, hfile);
-  fclose(hfile);
-  if (nb_read != 1) {
-    fprintf(stderr, "ERR: Failed to read '%s'\n", filepath.c_str());
+  if (!MapFile(filepath)) {
     return false;
   }
 
@@ -166,6 +142,20 @@ bool MachOFile::Load(std::string filepath, std::string target_arch)
     } else if (!strcmp(section->sectname, "__debug_str")) {
       debug_str = reinterpret_cast<char*>(header) + section->offset;
       debug_str_size = section->size;
+    } else if (!strncmp(section->sectname, "__debug_str_offs", sizeof(section->sectname))) {
+      SetDebugSection(DebugSection::str_offsets, reinterpret_cast<char*>(header) + section->offset, section->size);
+    } else if (!strncmp(section->sectname, "__debug_line_str", sizeof(section->sectname))) {
+      SetDebugSection(DebugSection::line_str, reinterpret_cast<char*>(header) + section->offset, section->size);
+    } else if (!strncmp(section->sectname, "__debug_addr", sizeof(section->sectname))) {
+      SetDebugSection(DebugSection::addr, reinterpret_cast<char*>(header) + section->offset, section->size);
+    } else if (!strncmp(section->sectname, "__debug_names", sizeof(section->sectname))) {
+      SetDebugSection(DebugSection::names, reinterpret_cast<char*>(header) + section->offset, section->size);
+    } else if (!strncmp(section->sectname, "__apple_names", sizeof(section->sectname))) {
+      SetDebugSection(DebugSection::apple_names, reinterpret_cast<char*>(header) + section->offset, section->size);
+    } else if (!strncmp(section->sectname, "__apple_types", sizeof(section->sectname))) {
+      SetDebugSection(DebugSection::apple_types, reinterpret_cast<char*>(header) + section->offset, section->size);
+    } else if (!strncmp(section->sectname, "__debug_types", sizeof(section->sectname))) {
+      SetDebugSection(DebugSection::types, reinterpret_cast<char*>(header) + section->offset, section->size);
     }
 
     section++;
@@ -1,20 +1,187 @@
 #include "TreeBuilder.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <unordered_set>
+#include "hash.h"
+
+TreeBuilder::TreeBuilder()
+  : arena_(new Arena()),
+    elements_(arena_.get()),
+    members_(arena_.get()),
+    parents_(arena_.get()),
+    type_names_(arena_.get()),
+    replaced_ids_(0, std::hash<uint64_t>(), std::equal_to<uint64_t>(), 
+                  ArenaAllocator<std::pair<const uint64_t, uint64_t>>(arena_.get())),
+    scopes_(arena_.get()),
+    scope_ids_(0, ScopeKeyHash(), std::equal_to<ScopeKey>(), 
+               ArenaAllocator<std::pair<const ScopeKey, uint32_t>>(arena_.get())),
+    nested_elements_(arena_.get()),
+    open_members_(arena_.get()),
+    open_parents_(arena_.get()) {
+  scopes_.push_back({kGlobalScope, nullptr, 0});
+}
 
-TreeBuilder::TreeBuilder() = default;
 TreeBuilder::~TreeBuilder() = default;
 
-std::string TreeBuilder::GenerateJson() {
+TreeBuilder& TreeBuilder::operator=(TreeBuilder&& other) {
+  std::swap(arena_, other.arena_);
+  std::swap(elements_, other.elements_);
+  std::swap(members_, other.members_);
+  std::swap(parents_, other.parents_);
+  std::swap(type_names_, other.type_names_);
+  replaced_ids_.swap(other.replaced_ids_);
+  std::swap(scopes_, other.scopes_);
+  scope_ids_.swap(other.scope_ids_);
+  scope_names_.swap(other.scope_names_);
+  loaded_data_.swap(other.loaded_data_);
+  std::swap(nested_elements_, other.nested_elements_);
+  std::swap(open_members_, other.open_members_);
+  std::swap(open_parents_, other.open_parents_);
+  std::swap(last_parsed_type_, other.last_parsed_type_);
+  return *this;
+}
+
+std::string TreeBuilder::GenerateJson(const JsonOptions& options) {
+  StringTable strings;
+  JsonContext context = {options.string_table ? &strings : nullptr, nullptr};
+
+  // The dense ids are the indexes of the elements in the output, without
+  // the placeholders of the ignored DIEs
+  std::unordered_map<uint64_t, uint32_t> dense_ids;
+  if (options.dense_ids) {
+    uint32_t dense_id = 0;
+    for (size_t i = 0; i < elements_.size(); i++) {
+      if (elements_.types[i] != ElementType::none) {
+        dense_ids.emplace(elements_.ids[i], dense_id++);
+      }
+    }
+    context.dense_ids = &dense_ids;
+  }
+
   std::string result;
-  result += "{";
+  std::string offsets;
   for (size_t i = 0; i < elements_.size(); i++) {
-    result += elements_[i].GenerateJson();
-    if (i+1 < elements_.size()) { // not the last one
+    if (options.dense_ids && elements_.types[i] == ElementType::none) {
+      continue;
+    }
+    if (!result.empty()) { // not the first one
       result += ",";
     }
+    uint32_t scope = elements_.scopes[i];
+    const char* scope_name = nullptr;
+    if (scope != kGlobalScope && scope != kLocalScope) {
+      scope_name = ScopeName(scope).c_str();
+    }
+    result += ElementJson(context, i, scope_name);
+    if (options.id_map) {
+      offsets += (offsets.empty() ? "" : ",") + std::to_string(elements_.ids[i]);
+    }
   }
-  result += "}";
 
-  return result;
+  // The tables are known once all the elements are generated
+  std::string json = "{";
+  if (options.string_table) {
+    json += "\"strings\":" + strings.GenerateJson() + ",";
+  }
+  if (options.dense_ids) {
+    if (options.id_map) {
+      json += "\"offsets\":[" + offsets + "],";
+    }
+    json += "\"types\":[" + result + "]";
+  } else {
+    json += result;
+  }
+  if (json.back() == ',') {
+    json.pop_back();
+  }
+  json += "}";
+  return json;
+}
+
+TreeBuilder::Elements::Elements(Arena* arena)
+  : types(arena),
+    ids(arena),
+    names(arena),
+    sizes(arena),
+    type_ids(arena),
+    counts(arena),
+    scopes(arena),
+    declarations(arena),
+    members(arena),
+    parents(arena) {
+}
+
+void TreeBuilder::Elements::Add(ElementType type, uint64_t id) {
+  types.push_back(type);
+  ids.push_back(id);
+  names.push_back(nullptr);
+  sizes.push_back(0);
+  type_ids.push_back(0);
+  counts.push_back(0);
+  scopes.push_back(kGlobalScope);
+  declarations.push_back(false);
+  members.push_back({0, 0});
+  parents.push_back({0, 0});
+}
+
+void TreeBuilder::Elements::Truncate(size_t size) {
+  types.resize(size);
+  ids.resize(size);
+  names.resize(size);
+  sizes.resize(size);
+  type_ids.resize(size);
+  counts.resize(size);
+  scopes.resize(size);
+  declarations.resize(size);
+  members.resize(size);
+  parents.resize(size);
+}
+
+void TreeBuilder::Elements::Move(size_t from, size_t to) {
+  types[to] = types[from];
+  ids[to] = ids[from];
+  names[to] = names[from];
+  sizes[to] = sizes[from];
+  type_ids[to] = type_ids[from];
+  counts[to] = counts[from];
+  scopes[to] = scopes[from];
+  declarations[to] = declarations[from];
+  members[to] = members[from];
+  parents[to] = parents[from];
+}
+
+void TreeBuilder::CloseLevel() {
+  Level level = nested_elements_.back();
+  nested_elements_.pop_back();
+
+  // The levels of the children of nested filtered out DIEs share the same
+  // element, it's closed with the last one
+  if (!nested_elements_.empty() && nested_elements_.back().element == level.element) {
+    return;
+  }
+  auto store = [](auto& open, size_t first_open, auto& stored, Range& range) {
+    if (open.size() <= first_open) {
+      return;
+    }
+    // An element closed again is moved to the end, its records stay together
+    size_t count = open.size() - first_open;
+    if (range.count && range.first + range.count != stored.size()) {
+      for (uint32_t i = 0; i < range.count; i++) {
+        stored.push_back(stored[range.first + i]);
+      }
+      range.first = static_cast<uint32_t>(stored.size() - range.count);
+    } else if (!range.count) {
+      range.first = static_cast<uint32_t>(stored.size());
+    }
+    for (size_t i = first_open; i < open.size(); i++) {
+      stored.push_back(open[i]);
+    }
+    range.count += static_cast<uint32_t>(count);
+    open.resize(first_open);
+  };
+  store(open_members_, level.first_member, members_, elements_.members[level.element]);
+  store(open_parents_, level.first_parent, parents_, elements_.parents[level.element]);
 }
 
 void TreeBuilder::EndOfChildren() {
@@ -25,11 +192,11 @@ void TreeBuilder::EndOfChildren() {
   }
   
   // The next children will be about the previous element
-  nested_elements_.pop_back();
+  CloseLevel();
 
   // Update the type of the current element
   if (!nested_elements_.empty()) {
-    last_parsed_type_ = elements_[nested_elements_.back()].type_;
+    last_parsed_type_ = elements_.types[nested_elements_.back().element];
   }
 }
 
@@ -38,11 +205,12 @@ void TreeBuilder::AddElement(ElementType element_type, uint64_t tag_id, bool has
 
   ElementType current_element_type = ElementType::none;
   if (!nested_elements_.empty()) {
-    current_element_type = elements_[nested_elements_.back()].type_;
+    current_element_type = elements_.types[nested_elements_.back().element];
   }
 
   switch(element_type) {
     case ElementType::none:
+      last_parsed_type_ = element_type;   // Its attributes are ignored
       break;
     case ElementType::member:         // Member
       if (current_element_type == ElementType::none) {
@@ -52,7 +220,7 @@ void TreeBuilder::AddElement(ElementType element_type, uint64_t tag_id, bool has
         fprintf(stderr, "Can't add a member if the element list is empty\n");
         break;
       }
-      elements_[nested_elements_.back()].members_.push_back(Element(element_type, tag_id));
+      open_members_.push_back({tag_id, nullptr, 0, 0, 0});
       last_parsed_type_ = element_type;
       element_added = true;
       break;
@@ -64,14 +232,14 @@ void TreeBuilder::AddElement(ElementType element_type, uint64_t tag_id, bool has
         fprintf(stderr, "Can't add a parent if the element list is empty\n");
         break;
       }
-      elements_[nested_elements_.back()].parents_.push_back({tag_id, 0});
+      open_parents_.push_back({tag_id, 0});
       last_parsed_type_ = element_type;
       element_added = true;
       break;
     case ElementType::subrange_type:  // Subrange
       break;                          // Just update the current element type
     default:
-      elements_.push_back(Element(element_type, tag_id));
+      elements_.Add(element_type, tag_id);
       last_parsed_type_ = element_type;
       element_added = true;
   }
@@ -79,12 +247,52 @@ void TreeBuilder::AddElement(ElementType element_type, uint64_t tag_id, bool has
   if (has_children) {
     if (!element_added) {
       // Add a useless element to keep the stack in a correct state
-      elements_.push_back(Element(ElementType::none, 0));
+      elements_.Add(ElementType::none, 0);
     }
-    nested_elements_.push_back(elements_.size()-1);
+    nested_elements_.push_back({elements_.size()-1, open_members_.size(), open_parents_.size()});
   }
 }
 
+void TreeBuilder::AddFilteredLevel() {
+  // The children of nested filtered out DIEs share the same useless element
+  if (!nested_elements_.empty() && elements_.types[nested_elements_.back().element] == ElementType::none) {
+    nested_elements_.push_back(nested_elements_.back());
+    return;
+  }
+  elements_.Add(ElementType::none, 0);
+  nested_elements_.push_back({elements_.size()-1, open_members_.size(), open_parents_.size()});
+}
+
+TreeBuilder::Member* TreeBuilder::OpenMember(const char* field) {
+  if (nested_elements_.empty()) {
+    return nullptr;
+  }
+  const Level& current_level = nested_elements_.back();
+  if (elements_.types[current_level.element] == ElementType::none) {
+    return nullptr; // don't update this element
+  }
+  if (open_members_.size() <= current_level.first_member) {
+    fprintf(stderr, "Can't set the member %s if the members list is empty\n", field);
+    return nullptr;
+  }
+  return &open_members_.back();
+}
+
+TreeBuilder::Parent* TreeBuilder::OpenParent(const char* field) {
+  if (nested_elements_.empty()) {
+    return nullptr;
+  }
+  const Level& current_level = nested_elements_.back();
+  if (elements_.types[current_level.element] == ElementType::none) {
+    return nullptr; // don't update this element
+  }
+  if (open_parents_.size() <= current_level.first_parent) {
+    fprintf(stderr, "Can't set the parent %s if the parents list is empty\n", field);
+    return nullptr;
+  }
+  return &open_parents_.back();
+}
+
 void TreeBuilder::SetElementName(const char* name) {
   if (elements_.empty()) {
     return;
@@ -95,24 +303,14 @@ void TreeBuilder::SetElementName(const char* name) {
   }
 
   if (last_parsed_type_ == ElementType::member) {
-    if (nested_elements_.empty()) {
-      return;
+    Member* member = OpenMember("name");
+    if (member) {
+      member->name = name;
     }
-    Element& current_element = elements_[nested_elements_.back()];
-    if (current_element.type_ == ElementType::none) {
-      return; // don't update this element
-    }
-
-    if (current_element.members_.empty()) {
-      fprintf(stderr, "Can't set the member name if the members list is empty\n");
-      return;
-    }
-
-    current_element.members_.back().name_ = name;
     return;
   }
 
-  elements_.back().name_ = name;
+  elements_.names.back() = name;
 }
 
 void TreeBuilder::SetElementSize(uint64_t size) {
@@ -124,25 +322,14 @@ void TreeBuilder::SetElementSize(uint64_t size) {
   }
 
   if (last_parsed_type_ == ElementType::member) {
-    if (nested_elements_.empty()) {
-      return;
+    Member* member = OpenMember("size");
+    if (member) {
+      member->size = size;
     }
-    Element& current_element = elements_[nested_elements_.back()];
-    if (current_element.type_ == ElementType::none) {
-      return; // don't update this element
-    }
-
-    if (current_element.members_.empty()) {
-      fprintf(stderr, "Can't set the member size if the members list is "
-        "empty\n");
-      return;
-    }
-
-    current_element.members_.back().size_ = size;
     return;
   }
 
-  elements_.back().size_ = size; 
+  elements_.sizes.back() = size; 
 }
 
 void TreeBuilder::SetElementOffset(uint64_t offset) {
@@ -155,37 +342,17 @@ void TreeBuilder::SetElementOffset(uint64_t offset) {
 
   switch (last_parsed_type_) {
     case ElementType::member: {
-      if (nested_elements_.empty()) {
-        break;
-      }
-      Element& current_element = elements_[nested_elements_.back()];
-      if (current_element.type_ == ElementType::none) {
-        break; // don't update this element
-      }
-
-      if (current_element.members_.empty()) {
-        fprintf(stderr, "Can't set the member offset if the members list is "
-          "empty\n");
-        break;
+      Member* member = OpenMember("offset");
+      if (member) {
+        member->offset = offset;
       }
-      current_element.members_.back().offset_ = offset;
       break;
     }
     case ElementType::inheritance: {
-      if (nested_elements_.empty()) {
-        break;
-      }
-      Element& current_element = elements_[nested_elements_.back()];
-      if (current_element.type_ == ElementType::none) {
-        break; // don't update this element
-      }
-
-      if (current_element.parents_.empty()) {
-        fprintf(stderr, "Can't set the parent offset if the parents list is "
-          "empty\n");
-        break;
+      Parent* parent = OpenParent("offset");
+      if (parent) {
+        parent->offset = offset;
       }
-      current_element.parents_.back().offset = offset;
       break;
     }
     default:
@@ -203,43 +370,23 @@ void TreeBuilder::SetElementType(uint64_t type_id) {
 
   switch (last_parsed_type_) {
     case ElementType::member: {
-      if (nested_elements_.empty()) {
-        break;
+      Member* member = OpenMember("type");
+      if (member) {
+        member->type_id = type_id;
       }
-      Element& current_element = elements_[nested_elements_.back()];
-      if (current_element.type_ == ElementType::none) {
-        break; // don't update this element
-      }
-
-      if (current_element.members_.empty()) {
-        fprintf(stderr, "Can't set the member type if the members list is "
-          "empty\n");
-        break;
-      }
-      current_element.members_.back().type_id_ = type_id;
       break;
     }
     case ElementType::inheritance: {
-      if (nested_elements_.empty()) {
-        break;
+      Parent* parent = OpenParent("type");
+      if (parent) {
+        parent->id = type_id;
       }
-      Element& current_element = elements_[nested_elements_.back()];
-      if (current_element.type_ == ElementType::none) {
-        break; // don't update this element
-      }
-
-      if (current_element.parents_.empty()) {
-        fprintf(stderr, "Can't set the parent type if the parents list is "
-          "empty\n");
-        break;
-      }
-      elements_[nested_elements_.back()].parents_.back().id = type_id;
       break;
     }
     case ElementType::subrange_type:
       break; // do nothing
     default:
-      elements_.back().type_id_ = type_id;
+      elements_.type_ids.back() = type_id;
       break;
   }
 }
@@ -251,7 +398,1101 @@ void TreeBuilder::SetElementCount(uint64_t count) {
   if (last_parsed_type_ != ElementType::subrange_type) {
     return;
   }
-  elements_.back().count_ = count;
+  elements_.counts.back() = count;
+}
+
+// static
+bool TreeBuilder::IsNamedType(ElementType element_type) {
+  switch (element_type) {
+    case ElementType::class_type:
+    case ElementType::enumerator_type:
+    case ElementType::structure_type:
+    case ElementType::typedef2:
+    case ElementType::union_type:
+    case ElementType::base_type:
+      return true;
+    default:
+      return false;
+  }
+}
+
+void TreeBuilder::BeginUnit() {
+  EndUnit();
+}
+
+void TreeBuilder::EndUnit() {
+  while (!nested_elements_.empty()) {
+    CloseLevel();
+  }
+  last_parsed_type_ = ElementType::none;
+}
+
+void TreeBuilder::DiscardElements(size_t first_element) {
+  if (first_element >= elements_.size()) {
+    return;
+  }
+  // The open members and parents of the discarded elements are the last ones
+  while (!nested_elements_.empty() && nested_elements_.back().element >= first_element) {
+    open_members_.resize(std::min(open_members_.size(), nested_elements_.back().first_member));
+    open_parents_.resize(std::min(open_parents_.size(), nested_elements_.back().first_parent));
+    nested_elements_.pop_back();
+  }
+  size_t first_member = members_.size();
+  size_t first_parent = parents_.size();
+  for (size_t i = first_element; i < elements_.size(); i++) {
+    if (elements_.members[i].count) {
+      first_member = std::min<size_t>(first_member, elements_.members[i].first);
+    }
+    if (elements_.parents[i].count) {
+      first_parent = std::min<size_t>(first_parent, elements_.parents[i].first);
+    }
+  }
+  members_.resize(first_member);
+  parents_.resize(first_parent);
+  elements_.Truncate(first_element);
+  while (!type_names_.empty() && type_names_.back().element >= first_element) {
+    type_names_.pop_back();
+  }
+  last_parsed_type_ = ElementType::none;
+}
+
+void TreeBuilder::CompactRanges(size_t first_element, size_t first_member, size_t first_parent) {
+  // The records are moved in the order of their position, toward the
+  // beginning, the ones of an inner element are before the ones of its
+  // parent element
+  auto compact = [this, first_element](ArenaArray<Range>& ranges, auto& stored, size_t first) {
+    std::vector<std::pair<uint32_t, size_t>> positions;
+    for (size_t i = first_element; i < elements_.size(); i++) {
+      if (ranges[i].count) {
+        positions.push_back({ranges[i].first, i});
+      }
+    }
+    if (!std::is_sorted(positions.begin(), positions.end())) {
+      std::sort(positions.begin(), positions.end());
+    }
+    size_t kept = first;
+    for (const std::pair<uint32_t, size_t>& position : positions) {
+      Range& range = ranges[position.second];
+      if (kept != range.first) {
+        for (uint32_t i = 0; i < range.count; i++) {
+          stored[kept + i] = stored[range.first + i];
+        }
+        range.first = static_cast<uint32_t>(kept);
+      }
+      kept += range.count;
+    }
+    stored.resize(kept);
+  };
+  compact(elements_.members, members_, first_member);
+  compact(elements_.parents, parents_, first_parent);
+}
+
+void TreeBuilder::GetTypeReferences(size_t first_element, std::vector<uint64_t>& type_ids) const {
+  for (size_t i = first_element; i < elements_.size(); i++) {
+    if (elements_.types[i] == ElementType::none) {
+      continue;   // Placeholder of an ignored DIE
+    }
+    if (elements_.type_ids[i]) {
+      type_ids.push_back(elements_.type_ids[i]);
+    }
+    const Range& members = elements_.members[i];
+    for (uint32_t j = members.first; j < members.first + members.count; j++) {
+      if (members_[j].type_id) {
+        type_ids.push_back(members_[j].type_id);
+      }
+    }
+    const Range& parents = elements_.parents[i];
+    for (uint32_t j = parents.first; j < parents.first + parents.count; j++) {
+      if (parents_[j].id) {
+        type_ids.push_back(parents_[j].id);
+      }
+    }
+  }
+  for (size_t i = type_names_.size(); i > 0 && type_names_[i - 1].element >= first_element; i--) {
+    if (type_names_[i - 1].declaration && type_names_[i - 1].link) {
+      type_ids.push_back(type_names_[i - 1].link);
+    }
+  }
+}
+
+void TreeBuilder::GetDeclarations(size_t first_element, 
+                                  std::vector<std::pair<uint32_t, const char*>>& declarations) const {
+  for (size_t i = type_names_.size(); i > 0 && type_names_[i - 1].element >= first_element; i--) {
+    const TypeName& type_name = type_names_[i - 1];
+    if (type_name.declaration && type_name.name && !type_name.link) {
+      declarations.emplace_back(type_name.scope, type_name.name);
+    }
+  }
+}
+
+void TreeBuilder::GetElementIds(size_t first_element, std::vector<uint64_t>& ids) const {
+  for (size_t i = first_element; i < elements_.size(); i++) {
+    if (elements_.types[i] != ElementType::none) {
+      ids.push_back(elements_.ids[i]);
+    }
+  }
+}
+
+uint32_t TreeBuilder::InternScope(uint32_t parent, const char* name, uint64_t unit) {
+  ScopeKey key = {parent, unit, name ? std::string_view(name) : std::string_view()};
+  auto inserted = scope_ids_.emplace(key, static_cast<uint32_t>(scopes_.size()));
+  if (inserted.second) {
+    scopes_.push_back({parent, name, unit});
+  }
+  return inserted.first->second;
+}
+
+const std::string& TreeBuilder::ScopeName(uint32_t scope) {
+  // The parents are interned before their children. All the names are built
+  // at once, their addresses don't change during the output.
+  for (size_t i = scope_names_.size(); i < scopes_.size(); i++) {
+    const Scope& interned = scopes_[i];
+    if (i == kGlobalScope) {
+      scope_names_.emplace_back();
+      continue;
+    }
+    std::string name = interned.parent != kGlobalScope ? scope_names_[interned.parent] + "::" : "";
+    name += interned.name ? interned.name : "(anonymous namespace)";
+    scope_names_.push_back(std::move(name));
+  }
+  return scope_names_[scope];
+}
+
+void TreeBuilder::SetElementScope(uint32_t scope, const char* name, bool declarable, bool declaration, 
+                                  uint64_t link) {
+  if (elements_.empty()) {
+    return;
+  }
+  elements_.scopes.back() = scope;
+  elements_.declarations.back() = declaration;
+  if (declarable && scope != kLocalScope) {
+    type_names_.push_back({elements_.size()-1, scope, name, declaration, link});
+  }
+}
+
+namespace {
+  enum HashState : uint8_t {
+    kUnhashed,
+    kHashing,   // Reference cycle
+    kHashed
+  };
+
+  uint64_t HashString(const char* str) {
+    return str ? std::hash<std::string_view>()(str) : 0;
+  }
+}
+
+size_t TreeBuilder::FindUnitType(const UnitTypes& unit, uint64_t id) const {
+  auto it_element = std::lower_bound(unit.elements.begin(), unit.elements.end(), 
+                                     std::make_pair(id, static_cast<size_t>(0)));
+  if (it_element == unit.elements.end() || it_element->first != id) {
+    return SIZE_MAX;
+  }
+  return it_element->second;
+}
+
+uint64_t TreeBuilder::ReferenceHash(UnitTypes& unit, uint64_t id) {
+  size_t element = FindUnitType(unit, id);
+  if (element == SIZE_MAX) {
+    // Type of another unit, type units have the same ids in all the units
+    return HashMix(1, id);
+  }
+
+  // The named types are referenced by name, so the recursion stops at them
+  // and a declaration matches its definition
+  ElementType kind = elements_.types[element];
+  const char* name = elements_.names[element];
+  uint32_t scope = elements_.scopes[element];
+  if (name && IsNamedType(kind) && scope != kLocalScope) {
+    if (kind == ElementType::class_type || kind == ElementType::union_type) {
+      kind = ElementType::structure_type;
+    }
+    return HashMix(HashMix(HashMix(2, kind), scope), HashString(name));
+  }
+  return TypeHash(unit, element);
+}
+
+uint64_t TreeBuilder::TypeHash(UnitTypes& unit, size_t element) {
+  size_t index = element - unit.first_element;
+  if (unit.states[index] == kHashed) {
+    return unit.hashes[index];
+  }
+  if (unit.states[index] == kHashing) {
+    return HashMix(3, elements_.types[element]);
+  }
+  unit.states[index] = kHashing;
+
+  uint64_t hash = HashMix(elements_.types[element], elements_.declarations[element]);
+  hash = HashMix(hash, HashString(elements_.names[element]));
+  hash = HashMix(hash, elements_.scopes[element]);
+  hash = HashMix(hash, elements_.sizes[element]);
+  hash = HashMix(hash, elements_.counts[element]);
+  uint64_t type_id = elements_.type_ids[element];
+  hash = HashMix(hash, type_id ? ReferenceHash(unit, type_id) : 0);
+  // The declarations of type units with the same name are different types
+  // if they have different signatures
+  uint64_t link = elements_.declarations[element] ? unit.links[index] : 0;
+  hash = HashMix(hash, link ? ReferenceHash(unit, link) : 0);
+  const Range& members = elements_.members[element];
+  for (uint32_t i = members.first; i < members.first + members.count; i++) {
+    const Member& member = members_[i];
+    hash = HashMix(hash, HashString(member.name));
+    hash = HashMix(hash, member.offset);
+    hash = HashMix(hash, member.size);
+    hash = HashMix(hash, member.type_id ? ReferenceHash(unit, member.type_id) : 0);
+  }
+  const Range& parents = elements_.parents[element];
+  for (uint32_t i = parents.first; i < parents.first + parents.count; i++) {
+    const Parent& parent = parents_[i];
+    hash = HashMix(hash, parent.offset);
+    hash = HashMix(hash, parent.id ? ReferenceHash(unit, parent.id) : 0);
+  }
+
+  unit.hashes[index] = hash;
+  unit.states[index] = kHashed;
+  return hash;
+}
+
+bool TreeBuilder::SameStructure(size_t element, size_t other) const {
+  // The referenced types are only compared by the hash
+  auto same_name = [](const char* name, const char* other_name) {
+    return name == other_name || (name && other_name && !strcmp(name, other_name));
+  };
+  if (elements_.types[element] != elements_.types[other] ||
+      elements_.declarations[element] != elements_.declarations[other] ||
+      !same_name(elements_.names[element], elements_.names[other]) ||
+      elements_.scopes[element] != elements_.scopes[other] ||
+      elements_.sizes[element] != elements_.sizes[other] ||
+      elements_.counts[element] != elements_.counts[other] ||
+      !elements_.type_ids[element] != !elements_.type_ids[other]) {
+    return false;
+  }
+
+  const Range& members = elements_.members[element];
+  const Range& other_members = elements_.members[other];
+  if (members.count != other_members.count) {
+    return false;
+  }
+  for (uint32_t i = 0; i < members.count; i++) {
+    const Member& member = members_[members.first + i];
+    const Member& other_member = members_[other_members.first + i];
+    if (member.offset != other_member.offset || member.size != other_member.size ||
+        !member.type_id != !other_member.type_id || !same_name(member.name, other_member.name)) {
+      return false;
+    }
+  }
+
+  const Range& parents = elements_.parents[element];
+  const Range& other_parents = elements_.parents[other];
+  if (parents.count != other_parents.count) {
+    return false;
+  }
+  for (uint32_t i = 0; i < parents.count; i++) {
+    const Parent& parent = parents_[parents.first + i];
+    const Parent& other_parent = parents_[other_parents.first + i];
+    if (parent.offset != other_parent.offset || !parent.id != !other_parent.id) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void TreeBuilder::InitUnitTypes(size_t first_element, UnitTypes& unit) const {
+  // The DIEs are in the order of their ids
+  unit.first_element = first_element;
+  for (size_t i = first_element; i < elements_.size(); i++) {
+    if (elements_.types[i] != ElementType::none) {
+      unit.elements.push_back({elements_.ids[i], i});
+    }
+  }
+  if (!std::is_sorted(unit.elements.begin(), unit.elements.end())) {
+    std::sort(unit.elements.begin(), unit.elements.end());
+  }
+  unit.hashes.resize(elements_.size() - first_element);
+  unit.states.resize(elements_.size() - first_element, kUnhashed);
+  unit.links.resize(elements_.size() - first_element, 0);
+  for (size_t i = type_names_.size(); i > 0 && type_names_[i - 1].element >= first_element; i--) {
+    unit.links[type_names_[i - 1].element - first_element] = type_names_[i - 1].link;
+  }
+}
+
+void TreeBuilder::SummarizeTypes(size_t first_element, std::vector<TypeSummary>& types) {
+  if (first_element >= elements_.size()) {
+    return;
+  }
+  UnitTypes unit;
+  InitUnitTypes(first_element, unit);
+  for (const std::pair<uint64_t, size_t>& type : unit.elements) {
+    types.push_back({TypeHash(unit, type.second), elements_.types[type.second], elements_.sizes[type.second],
+                     elements_.declarations[type.second]});
+  }
+}
+
+void TreeBuilder::DeduplicateTypes(size_t first_element, TypeTable& type_table) {
+  if (first_element >= elements_.size()) {
+    return;
+  }
+
+  UnitTypes unit;
+  InitUnitTypes(first_element, unit);
+
+  // The first copy of each type is canonical
+  std::vector<uint64_t> canonical_ids(elements_.size() - first_element, 0);
+  std::vector<uint64_t*> inserted;   // Canonical elements of the unit, moved below
+  bool removed = false;
+  for (const std::pair<uint64_t, size_t>& type : unit.elements) {
+    uint64_t hash = TypeHash(unit, type.second);
+    auto candidates = type_table.Candidates(hash);
+    auto it_canonical = std::find_if(candidates.first, candidates.second, 
+                                     [&](const std::pair<const uint64_t, uint64_t>& candidate) {
+      return SameStructure(candidate.second, type.second);
+    });
+    if (it_canonical == candidates.second) {
+      inserted.push_back(&type_table.Insert(hash, type.second));
+      continue;
+    }
+    uint64_t canonical_id = elements_.ids[it_canonical->second];
+    canonical_ids[type.second - first_element] = canonical_id;
+    replaced_ids_[type.first] = canonical_id;
+    removed = true;
+  }
+  if (!removed) {
+    return;
+  }
+
+  // The members and the parents of the unit are the last ones
+  size_t first_member = members_.size();
+  size_t first_parent = parents_.size();
+  for (size_t i = first_element; i < elements_.size(); i++) {
+    if (elements_.members[i].count) {
+      first_member = std::min<size_t>(first_member, elements_.members[i].first);
+    }
+    if (elements_.parents[i].count) {
+      first_parent = std::min<size_t>(first_parent, elements_.parents[i].first);
+    }
+  }
+
+  // The references to the other units are replaced by MergeTypes
+  auto replace_id = [&](uint64_t& id) {
+    size_t element = id ? FindUnitType(unit, id) : SIZE_MAX;
+    if (element != SIZE_MAX && canonical_ids[element - first_element]) {
+      id = canonical_ids[element - first_element];
+    }
+  };
+  std::vector<size_t> new_indexes(elements_.size() - first_element, SIZE_MAX);
+  size_t kept = first_element;
+  for (size_t i = first_element; i < elements_.size(); i++) {
+    if (canonical_ids[i - first_element]) {
+      continue;
+    }
+    replace_id(elements_.type_ids[i]);
+    const Range& members = elements_.members[i];
+    for (uint32_t j = members.first; j < members.first + members.count; j++) {
+      replace_id(members_[j].type_id);
+    }
+    const Range& parents = elements_.parents[i];
+    for (uint32_t j = parents.first; j < parents.first + parents.count; j++) {
+      replace_id(parents_[j].id);
+    }
+    if (kept != i) {
+      elements_.Move(i, kept);
+    }
+    new_indexes[i - first_element] = kept++;
+  }
+  elements_.Truncate(kept);
+  CompactRanges(first_element, first_member, first_parent);
+  for (uint64_t* element : inserted) {
+    *element = new_indexes[*element - first_element];
+  }
+
+  // Same for the type names of the unit, they are the last ones
+  size_t first_name = type_names_.size();
+  while (first_name > 0 && type_names_[first_name - 1].element >= first_element) {
+    first_name--;
+  }
+  size_t kept_name = first_name;
+  for (size_t i = first_name; i < type_names_.size(); i++) {
+    size_t element = new_indexes[type_names_[i].element - first_element];
+    if (element != SIZE_MAX) {
+      type_names_[kept_name] = type_names_[i];
+      type_names_[kept_name++].element = element;
+    }
+  }
+  type_names_.resize(kept_name);
+  while (!nested_elements_.empty() && nested_elements_.back().element >= first_element) {
+    nested_elements_.pop_back();
+  }
+}
+
+void TreeBuilder::AppendUnits(TreeBuilder& other, const std::vector<size_t>& unit_ends, 
+                              TypeTable& type_table) {
+  // A scope is interned after its parent
+  std::vector<uint32_t> scope_ids(other.scopes_.size(), kGlobalScope);
+  for (size_t i = 1; i < other.scopes_.size(); i++) {
+    const Scope& scope = other.scopes_[i];
+    uint32_t parent = (scope.parent < i) ? scope_ids[scope.parent] : kGlobalScope;
+    scope_ids[i] = InternScope(parent, scope.name, scope.unit);
+  }
+  auto scope_id = [&](uint32_t scope) {
+    return (scope < scope_ids.size()) ? scope_ids[scope] : scope;   // kLocalScope
+  };
+
+  // The members and the parents are copied in the order of the elements
+  size_t first_element = 0;
+  size_t name = 0;
+  for (size_t unit_end : unit_ends) {
+    size_t unit_begin = elements_.size();
+    for (size_t i = first_element; i < unit_end && i < other.elements_.size(); i++) {
+      elements_.Add(other.elements_.types[i], other.elements_.ids[i]);
+      elements_.names.back() = other.elements_.names[i];
+      elements_.sizes.back() = other.elements_.sizes[i];
+      elements_.type_ids.back() = other.elements_.type_ids[i];
+      elements_.counts.back() = other.elements_.counts[i];
+      elements_.scopes.back() = scope_id(other.elements_.scopes[i]);
+      elements_.declarations.back() = other.elements_.declarations[i];
+      const Range& members = other.elements_.members[i];
+      elements_.members.back() = {static_cast<uint32_t>(members_.size()), members.count};
+      for (uint32_t j = 0; j < members.count; j++) {
+        members_.push_back(other.members_[members.first + j]);
+      }
+      const Range& parents = other.elements_.parents[i];
+      elements_.parents.back() = {static_cast<uint32_t>(parents_.size()), parents.count};
+      for (uint32_t j = 0; j < parents.count; j++) {
+        parents_.push_back(other.parents_[parents.first + j]);
+      }
+    }
+    for (; name < other.type_names_.size() && other.type_names_[name].element < unit_end; name++) {
+      TypeName type_name = other.type_names_[name];
+      type_name.element = unit_begin + (type_name.element - first_element);
+      type_name.scope = scope_id(type_name.scope);
+      type_names_.push_back(type_name);
+    }
+    DeduplicateTypes(unit_begin, type_table);
+    first_element = unit_end;
+  }
+
+  // The loaded names point in their data
+  for (std::vector<char>& data : other.loaded_data_) {
+    loaded_data_.push_back(std::move(data));
+  }
+  other = TreeBuilder();
+}
+
+void TreeBuilder::MergeTypes(std::vector<uint64_t>* ids) {
+  // A deduplicated declaration is replaced by the canonical one, itself
+  // replaced by the definition. The members and the parents of the removed
+  // declarations are left unused.
+  auto replace_id = [this](uint64_t& id) {
+    auto it_id = replaced_ids_.find(id);
+    while (it_id != replaced_ids_.end()) {
+      id = it_id->second;
+      it_id = replaced_ids_.find(id);
+    }
+  };
+
+  // The first definition of each type, or its first declaration without any.
+  // The types are keyed like the scopes, by their name in their scope.
+  std::unordered_map<ScopeKey, uint64_t, ScopeKeyHash> types;
+  std::unordered_map<uint64_t, size_t> declarations;  // Id to element
+  for (size_t i = 0; i < type_names_.size(); i++) {
+    const TypeName& type_name = type_names_[i];
+    uint64_t id = elements_.ids[type_name.element];
+    if (type_name.declaration) {
+      declarations.emplace(id, type_name.element);
+    } else if (type_name.name) {
+      types.emplace(ScopeKey{type_name.scope, 0, type_name.name}, id);
+    }
+  }
+
+  // The declarations linked to their definition by the DIEs are merged into
+  // it first, whatever their name, if the definition is parsed. It may be
+  // unnamed, like an anonymous union of a type unit.
+  auto link_ends = [&](const TypeName& type_name, uint64_t& declaration, uint64_t& definition) {
+    uint64_t id = elements_.ids[type_name.element];
+    declaration = type_name.declaration ? id : type_name.link;
+    definition = type_name.declaration ? type_name.link : id;
+    replace_id(declaration);
+    replace_id(definition);
+  };
+  std::unordered_set<uint64_t> definitions;
+  uint64_t declaration = 0;
+  uint64_t definition = 0;
+  for (size_t i = 0; i < type_names_.size(); i++) {
+    if (type_names_[i].link) {
+      link_ends(type_names_[i], declaration, definition);
+      definitions.insert(definition);
+    }
+  }
+  std::unordered_set<uint64_t> parsed_definitions;
+  for (size_t i = 0; i < elements_.size() && !definitions.empty(); i++) {
+    if (elements_.types[i] != ElementType::none && !elements_.declarations[i] && 
+        definitions.count(elements_.ids[i])) {
+      parsed_definitions.insert(elements_.ids[i]);
+    }
+  }
+  std::vector<bool> removed(elements_.size(), false);
+  for (size_t i = 0; i < type_names_.size(); i++) {
+    if (!type_names_[i].link) {
+      continue;
+    }
+    link_ends(type_names_[i], declaration, definition);
+    auto it_declaration = declarations.find(declaration);
+    if (it_declaration == declarations.end() || removed[it_declaration->second] || 
+        !parsed_definitions.count(definition)) {
+      continue;
+    }
+    replaced_ids_[declaration] = definition;
+    removed[it_declaration->second] = true;
+  }
+
+  for (size_t i = 0; i < type_names_.size(); i++) {
+    const TypeName& type_name = type_names_[i];
+    if (!type_name.declaration || !type_name.name || removed[type_name.element]) {
+      continue;
+    }
+    uint64_t id = elements_.ids[type_name.element];
+    auto inserted = types.emplace(ScopeKey{type_name.scope, 0, type_name.name}, id);
+    if (inserted.second) {
+      continue;   // Type declared but never defined
+    }
+    replaced_ids_[id] = inserted.first->second;
+    removed[type_name.element] = true;
+  }
+  type_names_.clear();
+  EndUnit();
+  if (replaced_ids_.empty()) {
+    return;
+  }
+
+  for (size_t i = 0; i < members_.size(); i++) {
+    replace_id(members_[i].type_id);
+  }
+  for (size_t i = 0; i < parents_.size(); i++) {
+    replace_id(parents_[i].id);
+  }
+  for (size_t i = 0; ids && i < ids->size(); i++) {
+    replace_id((*ids)[i]);
+  }
+  size_t kept = 0;
+  for (size_t i = 0; i < elements_.size(); i++) {
+    if (removed[i]) {
+      continue;
+    }
+    replace_id(elements_.type_ids[i]);
+    if (kept != i) {
+      elements_.Move(i, kept);
+    }
+    kept++;
+  }
+  elements_.Truncate(kept);
+  replaced_ids_.clear();
+}
+
+void TreeBuilder::KeepReferencedTypes(const std::vector<uint64_t>& ids) {
+  std::unordered_map<uint64_t, size_t> types;    // Id to element
+  for (size_t i = 0; i < elements_.size(); i++) {
+    if (elements_.types[i] != ElementType::none) {
+      types.emplace(elements_.ids[i], i);
+    }
+  }
+
+  std::vector<bool> selected(elements_.size(), false);
+  std::vector<uint64_t> pending(ids);
+  while (!pending.empty()) {
+    auto it_type = types.find(pending.back());
+    pending.pop_back();
+    if (it_type == types.end() || selected[it_type->second]) {
+      continue;
+    }
+    size_t i = it_type->second;
+    selected[i] = true;
+    pending.push_back(elements_.type_ids[i]);
+    const Range& members = elements_.members[i];
+    for (uint32_t j = members.first; j < members.first + members.count; j++) {
+      pending.push_back(members_[j].type_id);
+    }
+    const Range& parents = elements_.parents[i];
+    for (uint32_t j = parents.first; j < parents.first + parents.count; j++) {
+      pending.push_back(parents_[j].id);
+    }
+  }
+
+  // The members and the parents of the removed elements are left unused
+  size_t kept = 0;
+  for (size_t i = 0; i < elements_.size(); i++) {
+    if (!selected[i]) {
+      continue;
+    }
+    if (kept != i) {
+      elements_.Move(i, kept);
+    }
+    kept++;
+  }
+  elements_.Truncate(kept);
+}
+
+namespace {
+  // Format of SaveElements, changed with the layout of the data
+  const char kSavedMagic[4] = {'D', 'D', 'U', '3'};
+
+  // A reference is 0 for none, the id relative to the unit times 2 plus 1,
+  // or 2 followed by the signature of a type unit
+  const uint64_t kSignatureReference = 2;
+
+  void WriteVarint(std::string& data, uint64_t value) {
+    while (value >= 0x80) {
+      data += static_cast<char>(value | 0x80);
+      value >>= 7;
+    }
+    data += static_cast<char>(value);
+  }
+
+  // The length plus one, 0 for nullptr, then the NUL terminated string
+  void WriteString(std::string& data, const char* str) {
+    if (!str) {
+      WriteVarint(data, 0);
+      return;
+    }
+    size_t length = std::char_traits<char>::length(str);
+    WriteVarint(data, length + 1);
+    data.append(str, length + 1);
+  }
+
+  // Reads the data of WriteVarint and WriteString. Once past the end, all the
+  // values are 0 and valid() is false.
+  class SavedReader {
+  public:
+    SavedReader(const char* data, size_t size) : ptr_(data), end_(data + size) {}
+    bool valid() const { return valid_; }
+    bool at_end() const { return ptr_ == end_; }
+    void Fail() {
+      valid_ = false;
+      ptr_ = end_;
+    }
+
+    uint64_t Varint() {
+      uint64_t value = 0;
+      for (unsigned int shift = 0; shift < 64; shift += 7) {
+        if (ptr_ == end_) {
+          Fail();
+          return 0;
+        }
+        unsigned char byte = *ptr_++;
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (byte < 0x80) {
+          return value;
+        }
+      }
+      Fail();
+      return 0;
+    }
+
+    const char* String() {
+      uint64_t length = Varint();
+      if (!length) {
+        return nullptr;
+      }
+      if (length > static_cast<uint64_t>(end_ - ptr_) || ptr_[length - 1]) {
+        Fail();
+        return nullptr;
+      }
+      const char* str = ptr_;
+      ptr_ += length;
+      return str;
+    }
+
+  private:
+    const char* ptr_;
+    const char* end_;
+    bool valid_ = true;
+  };
+}
+
+bool TreeBuilder::SaveElements(size_t first_element, uint64_t unit_offset, uint64_t unit_size,
+                               const std::unordered_map<uint64_t, uint64_t>& signatures, 
+                               std::string& data, std::vector<const char*>& strings) const {
+  bool saved = true;
+  std::string elements;
+  auto write_string = [&strings](std::string& out, const char* str) {
+    if (str) {
+      strings.push_back(str);
+    }
+    WriteString(out, str);
+  };
+  auto write_reference = [&](uint64_t id) {
+    if (!id) {
+      WriteVarint(elements, 0);
+    } else if (id >= unit_offset && id - unit_offset < unit_size) {
+      WriteVarint(elements, (id - unit_offset) * 2 + 1);
+    } else {
+      std::unordered_map<uint64_t, uint64_t>::const_iterator it_signature = signatures.find(id);
+      if (it_signature == signatures.end()) {
+        saved = false;  // DIE of another unit
+        return;
+      }
+      WriteVarint(elements, kSignatureReference);
+      WriteVarint(elements, it_signature->second);
+    }
+  };
+
+  // The scopes are saved by name, with their parents first. They are
+  // numbered from 2, after the global and the local scopes.
+  std::string scopes;
+  std::unordered_map<uint32_t, uint64_t> saved_scopes;
+  std::vector<uint32_t> chain;
+  auto write_scope = [&](uint32_t scope) {
+    if (scope == kGlobalScope || scope == kLocalScope) {
+      WriteVarint(elements, scope == kGlobalScope ? 0 : 1);
+      return;
+    }
+    for (uint32_t ancestor = scope; ancestor != kGlobalScope && !saved_scopes.count(ancestor); 
+         ancestor = scopes_[ancestor].parent) {
+      chain.push_back(ancestor);
+    }
+    for (; !chain.empty(); chain.pop_back()) {
+      const Scope& interned = scopes_[chain.back()];
+      if (!interned.name && interned.unit != unit_offset) {
+        saved = false;  // Anonymous namespace of another unit
+      }
+      WriteVarint(scopes, interned.parent == kGlobalScope ? 0 : saved_scopes[interned.parent]);
+      write_string(scopes, interned.name);
+      saved_scopes.emplace(chain.back(), saved_scopes.size() + 2);
+    }
+    WriteVarint(elements, saved_scopes[scope]);
+  };
+
+  WriteVarint(elements, elements_.size() - first_element);
+  for (size_t i = first_element; i < elements_.size() && saved; i++) {
+    WriteVarint(elements, elements_.types[i]);
+    WriteVarint(elements, elements_.declarations[i]);
+    write_reference(elements_.ids[i]);
+    write_string(elements, elements_.names[i]);
+    write_scope(elements_.scopes[i]);
+    WriteVarint(elements, elements_.sizes[i]);
+    write_reference(elements_.type_ids[i]);
+    WriteVarint(elements, elements_.counts[i]);
+    const Range& members = elements_.members[i];
+    WriteVarint(elements, members.count);
+    for (uint32_t j = members.first; j < members.first + members.count; j++) {
+      const Member& member = members_[j];
+      write_reference(member.id);
+      write_string(elements, member.name);
+      WriteVarint(elements, member.size);
+      write_reference(member.type_id);
+      WriteVarint(elements, member.offset);
+    }
+    const Range& parents = elements_.parents[i];
+    WriteVarint(elements, parents.count);
+    for (uint32_t j = parents.first; j < parents.first + parents.count; j++) {
+      write_reference(parents_[j].id);
+      WriteVarint(elements, parents_[j].offset);
+    }
+  }
+
+  // The type names of the unit are the last ones
+  size_t first_name = type_names_.size();
+  while (first_name > 0 && type_names_[first_name - 1].element >= first_element) {
+    first_name--;
+  }
+  WriteVarint(elements, type_names_.size() - first_name);
+  for (size_t i = first_name; i < type_names_.size(); i++) {
+    WriteVarint(elements, type_names_[i].element - first_element);
+    write_string(elements, type_names_[i].name);
+    write_reference(type_names_[i].link);
+  }
+  if (!saved) {
+    return false;
+  }
+
+  data.assign(kSavedMagic, sizeof(kSavedMagic));
+  WriteVarint(data, saved_scopes.size());
+  data += scopes;
+  data += elements;
+  return true;
+}
+
+bool TreeBuilder::LoadElements(std::vector<char> data, uint64_t unit_offset, uint64_t unit_size,
+                               const std::unordered_map<uint64_t, uint64_t>& type_signatures) {
+  if (data.size() < sizeof(kSavedMagic) || memcmp(data.data(), kSavedMagic, sizeof(kSavedMagic))) {
+    return false;
+  }
+  // Kept even if the data is invalid, the scopes interned before the error
+  // reference it
+  loaded_data_.push_back(std::move(data));
+  const std::vector<char>& loaded = loaded_data_.back();
+  SavedReader reader(loaded.data() + sizeof(kSavedMagic), loaded.size() - sizeof(kSavedMagic));
+  auto read_reference = [&]() -> uint64_t {
+    uint64_t value = reader.Varint();
+    if (value & 1) {
+      uint64_t offset = value >> 1;
+      if (offset < unit_size) {
+        return unit_offset + offset;
+      }
+    } else if (value == kSignatureReference) {
+      std::unordered_map<uint64_t, uint64_t>::const_iterator it_type = type_signatures.find(reader.Varint());
+      if (it_type != type_signatures.end()) {
+        return it_type->second;
+      }
+    } else if (!value) {
+      return 0;
+    }
+    reader.Fail();
+    return 0;
+  };
+
+  // The saved scopes are interned again, the anonymous namespaces in the
+  // unit at its new offset
+  std::vector<uint32_t> scopes = {kGlobalScope, kLocalScope};
+  uint64_t scope_count = reader.Varint();
+  for (uint64_t i = 0; i < scope_count && reader.valid(); i++) {
+    uint64_t parent = reader.Varint();
+    const char* name = reader.String();
+    if (parent == 1 || parent >= scopes.size()) {
+      return false;
+    }
+    scopes.push_back(InternScope(scopes[parent], name, name ? 0 : unit_offset));
+  }
+  auto read_scope = [&]() -> uint32_t {
+    uint64_t scope = reader.Varint();
+    return scope < scopes.size() ? scopes[scope] : kLocalScope;
+  };
+
+  size_t first_element = elements_.size();
+  uint64_t element_count = reader.Varint();
+  for (uint64_t i = 0; i < element_count && reader.valid(); i++) {
+    uint64_t type = reader.Varint();
+    if (type > ElementType::const_type) {
+      reader.Fail();
+    }
+    bool declaration = reader.Varint();
+    elements_.Add(static_cast<ElementType>(type), read_reference());
+    elements_.declarations.back() = declaration;
+    elements_.names.back() = reader.String();
+    elements_.scopes.back() = read_scope();
+    elements_.sizes.back() = reader.Varint();
+    elements_.type_ids.back() = read_reference();
+    elements_.counts.back() = reader.Varint();
+    elements_.members.back().first = static_cast<uint32_t>(members_.size());
+    uint64_t member_count = reader.Varint();
+    for (uint64_t j = 0; j < member_count && reader.valid(); j++) {
+      Member member = {read_reference(), nullptr, 0, 0, 0};
+      member.name = reader.String();
+      member.size = reader.Varint();
+      member.type_id = read_reference();
+      member.offset = reader.Varint();
+      members_.push_back(member);
+      elements_.members.back().count++;
+    }
+    elements_.parents.back().first = static_cast<uint32_t>(parents_.size());
+    uint64_t parent_count = reader.Varint();
+    for (uint64_t j = 0; j < parent_count && reader.valid(); j++) {
+      uint64_t id = read_reference();
+      parents_.push_back({id, reader.Varint()});
+      elements_.parents.back().count++;
+    }
+  }
+
+  size_t first_name = type_names_.size();
+  uint64_t name_count = reader.Varint();
+  for (uint64_t i = 0; i < name_count && reader.valid(); i++) {
+    uint64_t element = reader.Varint();
+    const char* name = reader.String();
+    uint64_t link = read_reference();
+    if (element >= elements_.size() - first_element) {
+      reader.Fail();
+      break;
+    }
+    type_names_.push_back({first_element + element, elements_.scopes[first_element + element], name, 
+                           elements_.declarations[first_element + element], link});
+  }
+
+  if (!reader.valid() || !reader.at_end() || elements_.size() - first_element != element_count || 
+      type_names_.size() - first_name != name_count) {
+    DiscardElements(first_element);
+    return false;
+  }
+  return true;
+}
+
+bool TreeBuilder::SaveIndex(std::string& data) {
+  // The elements are numbered without the placeholders of the ignored DIEs
+  std::unordered_map<uint64_t, uint32_t> indexes;
+  for (size_t i = 0; i < elements_.size(); i++) {
+    if (elements_.types[i] != ElementType::none) {
+      indexes.emplace(elements_.ids[i], static_cast<uint32_t>(indexes.size()));
+    }
+  }
+  auto type_index = [&indexes](uint64_t id) {
+    std::unordered_map<uint64_t, uint32_t>::const_iterator it_index = indexes.find(id);
+    return it_index != indexes.end() ? it_index->second : TypeIndex::kNone;
+  };
+
+  // Each string is written once
+  std::string strings;
+  std::unordered_map<std::string_view, uint32_t> string_offsets;
+  auto string_offset = [&](const char* str) {
+    if (!str) {
+      return TypeIndex::kNone;
+    }
+    auto inserted = string_offsets.emplace(std::string_view(str), static_cast<uint32_t>(strings.size()));
+    if (inserted.second) {
+      strings.append(str, inserted.first->first.size() + 1);
+    }
+    return inserted.first->second;
+  };
+
+  std::vector<TypeIndex::Element> elements;
+  std::vector<TypeIndex::Member> members;
+  std::vector<TypeIndex::Parent> parents;
+  std::vector<TypeIndex::Name> names;
+  elements.reserve(indexes.size());
+  for (size_t i = 0; i < elements_.size(); i++) {
+    if (elements_.types[i] == ElementType::none) {
+      continue;
+    }
+    TypeIndex::Element indexed = {};
+    indexed.id = elements_.ids[i];
+    indexed.type_id = elements_.type_ids[i];
+    indexed.size = elements_.sizes[i];
+    indexed.count = elements_.counts[i];
+    indexed.type_index = type_index(elements_.type_ids[i]);
+    indexed.name = string_offset(elements_.names[i]);
+    uint32_t scope = elements_.scopes[i];
+    if (scope != kGlobalScope && scope != kLocalScope) {
+      indexed.scope = string_offset(ScopeName(scope).c_str());
+    } else {
+      indexed.scope = TypeIndex::kNone;
+    }
+    const Range& element_members = elements_.members[i];
+    const Range& element_parents = elements_.parents[i];
+    indexed.first_member = static_cast<uint32_t>(members.size());
+    indexed.member_count = element_members.count;
+    indexed.first_parent = static_cast<uint32_t>(parents.size());
+    indexed.parent_count = element_parents.count;
+    indexed.type = elements_.types[i];
+    indexed.declaration = elements_.declarations[i];
+    indexed.local = scope == kLocalScope;
+    for (uint32_t j = element_members.first; j < element_members.first + element_members.count; j++) {
+      const Member& member = members_[j];
+      members.push_back({member.type_id, member.offset, type_index(member.type_id), string_offset(member.name)});
+    }
+    for (uint32_t j = element_parents.first; j < element_parents.first + element_parents.count; j++) {
+      const Parent& parent = parents_[j];
+      parents.push_back({parent.id, parent.offset, type_index(parent.id), 0});
+    }
+    if (elements_.names[i]) {
+      names.push_back({TypeIndex::Hash(elements_.names[i]), static_cast<uint32_t>(elements.size())});
+    }
+    elements.push_back(indexed);
+  }
+  if (strings.size() >= TypeIndex::kNone || members.size() >= TypeIndex::kNone || 
+      parents.size() >= TypeIndex::kNone) {
+    fprintf(stderr, "ERR: Too many types for an index\n");
+    return false;
+  }
+  if (strings.empty()) {
+    strings.push_back('\0');
+  }
+
+  // The names are grouped by bucket, the bucket of a hash is its low bits
+  uint32_t bucket_count = 1;
+  while (bucket_count < names.size()) {
+    bucket_count *= 2;
+  }
+  std::stable_sort(names.begin(), names.end(), [bucket_count](const TypeIndex::Name& a, const TypeIndex::Name& b) {
+    return (a.hash & (bucket_count - 1)) < (b.hash & (bucket_count - 1));
+  });
+  std::vector<uint32_t> buckets(bucket_count + 1, 0);
+  for (const TypeIndex::Name& name : names) {
+    buckets[(name.hash & (bucket_count - 1)) + 1]++;
+  }
+  for (uint32_t i = 0; i < bucket_count; i++) {
+    buckets[i + 1] += buckets[i];
+  }
+
+  TypeIndex::Header header = {};
+  memcpy(header.magic, TypeIndex::kMagic, sizeof(header.magic));
+  header.element_count = static_cast<uint32_t>(elements.size());
+  header.member_count = static_cast<uint32_t>(members.size());
+  header.parent_count = static_cast<uint32_t>(parents.size());
+  header.bucket_count = bucket_count;
+  header.strings_size = strings.size();
+  data.assign(sizeof(header), '\0');
+  auto append_array = [&data](const void* array, size_t size) {
+    data.resize((data.size() + 7) & ~static_cast<size_t>(7), '\0');
+    uint64_t offset = data.size();
+    data.append(reinterpret_cast<const char*>(array), size);
+    return offset;
+  };
+  header.elements = append_array(elements.data(), elements.size() * sizeof(TypeIndex::Element));
+  header.members = append_array(members.data(), members.size() * sizeof(TypeIndex::Member));
+  header.parents = append_array(parents.data(), parents.size() * sizeof(TypeIndex::Parent));
+  header.buckets = append_array(buckets.data(), buckets.size() * sizeof(uint32_t));
+  header.names = append_array(names.data(), names.size() * sizeof(TypeIndex::Name));
+  header.strings = append_array(strings.data(), strings.size());
+  memcpy(&data[0], &header, sizeof(header));
+  return true;
+}
+
+void TreeBuilder::LoadIndexedTypes(const TypeIndex& index, const std::vector<uint32_t>& roots) {
+  // The types referenced are followed by their index, each type is added
+  // once, in the order of the index
+  std::vector<bool> selected(index.ElementCount(), false);
+  std::vector<uint32_t> pending(roots);
+  auto select = [&](uint32_t type_index) {
+    if (type_index < selected.size() && !selected[type_index]) {
+      pending.push_back(type_index);
+    }
+  };
+  while (!pending.empty()) {
+    uint32_t element_index = pending.back();
+    pending.pop_back();
+    const TypeIndex::Element* indexed = index.GetElement(element_index);
+    if (!indexed || selected[element_index]) {
+      continue;
+    }
+    selected[element_index] = true;
+    select(indexed->type_index);
+    const TypeIndex::Member* members = index.GetMembers(*indexed);
+    for (uint32_t i = 0; members && i < indexed->member_count; i++) {
+      select(members[i].type_index);
+    }
+    const TypeIndex::Parent* parents = index.GetParents(*indexed);
+    for (uint32_t i = 0; parents && i < indexed->parent_count; i++) {
+      select(parents[i].type_index);
+    }
+  }
+
+  for (uint32_t element_index = 0; element_index < selected.size(); element_index++) {
+    if (!selected[element_index]) {
+      continue;
+    }
+    const TypeIndex::Element& indexed = *index.GetElement(element_index);
+    if (indexed.type > ElementType::const_type) {
+      continue;
+    }
+    elements_.Add(static_cast<ElementType>(indexed.type), indexed.id);
+    elements_.names.back() = index.GetString(indexed.name);
+    elements_.sizes.back() = indexed.size;
+    elements_.type_ids.back() = indexed.type_id;
+    elements_.counts.back() = indexed.count;
+    elements_.declarations.back() = indexed.declaration;
+    // The qualified name is interned as a single scope
+    const char* scope = index.GetString(indexed.scope);
+    if (scope) {
+      elements_.scopes.back() = InternScope(kGlobalScope, scope, 0);
+    }
+    const TypeIndex::Member* members = index.GetMembers(indexed);
+    elements_.members.back() = {static_cast<uint32_t>(members_.size()), members ? indexed.member_count : 0};
+    for (uint32_t i = 0; members && i < indexed.member_count; i++) {
+      members_.push_back({0, index.GetString(members[i].name), 0, members[i].type_id, members[i].offset});
+    }
+    const TypeIndex::Parent* parents = index.GetParents(indexed);
+    elements_.parents.back() = {static_cast<uint32_t>(parents_.size()), parents ? indexed.parent_count : 0};
+    for (uint32_t i = 0; parents && i < indexed.parent_count; i++) {
+      parents_.push_back({parents[i].id, parents[i].offset});
+    }
+  }
 }
 
 // static
@@ -270,8 +1511,9 @@ std::string TreeBuilder::EscapeJsonString(const char* str) {
   return result;
 }
 
-const char* TreeBuilder::Element::TypeName() {
-  switch (type_) {
+// static
+const char* TreeBuilder::ElementTypeName(ElementType type) {
+  switch (type) {
     case ElementType::none: return "none";
     case ElementType::array_type: return "array";
     case ElementType::class_type: return "class";
@@ -288,56 +1530,117 @@ const char* TreeBuilder::Element::TypeName() {
   }
 }
 
-std::string TreeBuilder::Element::GenerateJson() {
-  std::string result;
+uint32_t TreeBuilder::StringTable::Intern(const char* str) {
+  std::unordered_map<const char*, uint32_t>::const_iterator it_id = ids_by_address_.find(str);
+  if (it_id != ids_by_address_.end()) {
+    return it_id->second;
+  }
 
-  // A member is a special case
-  if (type_ == ElementType::member) {
-    result = "{";
+  auto inserted = ids_by_content_.emplace(std::string_view(str), static_cast<uint32_t>(strings_.size()));
+  if (inserted.second) {
+    strings_.push_back(str);
+  }
+  ids_by_address_.emplace(str, inserted.first->second);
+  return inserted.first->second;
+}
 
-    if (type_id_) {
-      result += "\"type_id\":\""+std::to_string(type_id_)+"\",";
-    }
-    if (name_) {
-      result += "\"name\":\""+EscapeJsonString(name_)+"\",";
+std::string TreeBuilder::StringTable::GenerateJson() const {
+  std::string result = "[";
+  for (size_t i = 0; i < strings_.size(); i++) {
+    result += "\""+EscapeJsonString(strings_[i])+"\"";
+    if (i+1 < strings_.size()) {
+      result += ",";
     }
-    result += "\"offset\":"+std::to_string(offset_);
+  }
+  result += "]";
+  return result;
+}
 
-    result += "}";
-    return result;
+// static
+std::string TreeBuilder::JsonName(const JsonContext& context, const char* name) {
+  if (context.strings) {
+    return std::to_string(context.strings->Intern(name));
   }
+  return "\""+EscapeJsonString(name)+"\"";
+}
 
-  // The others are generic
-  result += "\""+std::to_string(id_)+"\":";
-  result += "{\"type\":\""+std::string(TypeName())+"\",";
-  if (type_id_) {
-    result += "\"type_id\":\""+std::to_string(type_id_)+"\",";
+// static
+bool TreeBuilder::JsonId(const JsonContext& context, uint64_t id, std::string& json_id) {
+  if (!context.dense_ids) {
+    json_id = "\""+std::to_string(id)+"\"";
+    return true;
   }
-  if (name_) {
-    result += "\"name\":\""+EscapeJsonString(name_)+"\",";
+  std::unordered_map<uint64_t, uint32_t>::const_iterator it_id = context.dense_ids->find(id);
+  if (it_id == context.dense_ids->end()) {
+    return false;   // DIE which isn't dumped
   }
-  if (size_) {
-    result += "\"size\":"+std::to_string(size_)+",";
+  json_id = std::to_string(it_id->second);
+  return true;
+}
+
+// static
+std::string TreeBuilder::MemberJson(const JsonContext& context, const Member& member) {
+  std::string result = "{";
+  std::string json_id;
+
+  if (member.type_id && JsonId(context, member.type_id, json_id)) {
+    result += "\"type_id\":"+json_id+",";
   }
-  if (count_) {
-    result += "\"count\":"+std::to_string(count_)+",";
+  if (member.name) {
+    result += "\"name\":"+JsonName(context, member.name)+",";
   }
-  if (parents_.size() > 0) {
+  result += "\"offset\":"+std::to_string(member.offset);
+
+  result += "}";
+  return result;
+}
+
+std::string TreeBuilder::ElementJson(const JsonContext& context, size_t element, const char* scope_name) const {
+  std::string result;
+  std::string json_id;
+
+  // The dense ids are implicit
+  if (!context.dense_ids) {
+    result += "\""+std::to_string(elements_.ids[element])+"\":";
+  }
+  result += "{\"type\":\""+std::string(ElementTypeName(elements_.types[element]))+"\",";
+  uint64_t type_id = elements_.type_ids[element];
+  if (type_id && JsonId(context, type_id, json_id)) {
+    result += "\"type_id\":"+json_id+",";
+  }
+  if (elements_.names[element]) {
+    result += "\"name\":"+JsonName(context, elements_.names[element])+",";
+  }
+  if (scope_name) {
+    result += "\"scope\":"+JsonName(context, scope_name)+",";
+  }
+  if (elements_.sizes[element]) {
+    result += "\"size\":"+std::to_string(elements_.sizes[element])+",";
+  }
+  if (elements_.counts[element]) {
+    result += "\"count\":"+std::to_string(elements_.counts[element])+",";
+  }
+  const Range& parents = elements_.parents[element];
+  if (parents.count > 0) {
     result += "\"parents\":[";
-    for (size_t i = 0; i < parents_.size(); i++) {
-      result += "{\"id\":\""+std::to_string(parents_[i].id)+"\",";
+    for (uint32_t i = parents.first; i < parents.first + parents.count; i++) {
+      result += "{";
+      if (JsonId(context, parents_[i].id, json_id)) {
+        result += "\"id\":"+json_id+",";
+      }
       result += "\"offset\":"+std::to_string(parents_[i].offset)+"}";
-      if (i+1 < parents_.size()) {
+      if (i+1 < parents.first + parents.count) {
         result += ",";
       }
     }
     result += "],";
   }
-  if (members_.size() > 0) {
+  const Range& members = elements_.members[element];
+  if (members.count > 0) {
     result += "\"members\":[";
-    for (size_t i = 0; i < members_.size(); i++) {
-      result += members_[i].GenerateJson();
-      if (i+1 < members_.size()) {
+    for (uint32_t i = members.first; i < members.first + members.count; i++) {
+      result += MemberJson(context, members_[i]);
+      if (i+1 < members.first + members.count) {
         result += ",";
       }
     }
@@ -349,4 +1652,4 @@ std::string TreeBuilder::Element::GenerateJson() {
   }
   result += "}";
   return result;
-}
\ No newline at end of file
+}
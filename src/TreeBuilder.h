@@ -1,15 +1,36 @@
 #pragma once
+#include <stdint.h>
 #include <string>
+#include <string_view>
 #include <map>
+#include <memory>
+#include <unordered_map>
 #include <vector>
+#include "Arena.h"
+#include "TypeIndex.h"
+#include "TypeTable.h"
 
 class TreeBuilder {
 public:
   TreeBuilder();
   ~TreeBuilder();
-  std::string GenerateJson();
+  TreeBuilder(TreeBuilder&&) = default;
+  // Swaps the builders: the elements of this one are released with other,
+  // before their arena
+  TreeBuilder& operator=(TreeBuilder&& other);
+  struct JsonOptions {
+    // The names are output once in the "strings" array, and the elements
+    // reference them by index
+    bool string_table = false;
+    // The elements are output in the "types" array, and reference each other
+    // by index
+    bool dense_ids = false;
+    // With dense_ids, the "offsets" array gives the DIE of each element
+    bool id_map = false;
+  };
+  std::string GenerateJson(const JsonOptions& options);
 
-  enum ElementType {
+  enum ElementType : uint8_t {
     none,
     array_type,
     class_type,
@@ -26,38 +47,248 @@ public:
   };
   void EndOfChildren();
   void AddElement(ElementType element_type, uint64_t tag_id, bool has_children);
+  // Open the children level of a filtered out DIE
+  void AddFilteredLevel();
   void SetElementName(const char* name);
   void SetElementSize(uint64_t size);
   void SetElementOffset(uint64_t offset);
   void SetElementType(uint64_t type_id);
   void SetElementCount(uint64_t count);
 
+  static bool IsNamedType(ElementType element_type);
+  // Start the elements of a new unit, they don't depend on the previous one
+  void BeginUnit();
+  // Close the elements left open by the DIEs of the unit. The members and
+  // the parents of an element are stored once all its children are added.
+  void EndUnit();
+  size_t ElementCount() const { return elements_.size(); }
+  // Heap allocations made to store the elements, see Arena
+  uint64_t HeapAllocations() const { return arena_->HeapAllocations(); }
+  // Remove the elements added since first_element
+  void DiscardElements(size_t first_element);
+  // Append the type ids referenced by the elements added since first_element,
+  // and the definitions linked to their declarations
+  void GetTypeReferences(size_t first_element, std::vector<uint64_t>& type_ids) const;
+  // Append the scope and the name of the declarations added since
+  // first_element without a link to their definition, see MergeTypes
+  void GetDeclarations(size_t first_element, std::vector<std::pair<uint32_t, const char*>>& declarations) const;
+  // Append the ids of the elements added since first_element
+  void GetElementIds(size_t first_element, std::vector<uint64_t>& ids) const;
+
+  // The scopes (namespaces, classes, ...) are interned, the elements only
+  // reference them by ID
+  static constexpr uint32_t kGlobalScope = 0;
+  static constexpr uint32_t kLocalScope = UINT32_MAX;  // Function or block
+  // ID of the scope named name in parent, unit is only set for the anonymous
+  // namespaces
+  uint32_t InternScope(uint32_t parent, const char* name, uint64_t unit);
+  // Qualified name of a scope, empty for the global scope
+  const std::string& ScopeName(uint32_t scope);
+  // Scope of the last element, a named type. The declarable ones are merged
+  // by MergeTypes. link is the id of the declaration of a definition
+  // (DW_AT_specification) or of the definition of a declaration (the type
+  // DIE of DW_AT_signature), 0 if the DIE has none.
+  void SetElementScope(uint32_t scope, const char* name, bool declarable, bool declaration, uint64_t link);
+  // Remove the elements added since first_element, a complete unit, which
+  // are structurally identical to a type of type_table, and add the others
+  // to it. The elements of type_table must be the ones of this builder.
+  void DeduplicateTypes(size_t first_element, TypeTable& type_table);
+  // Structural hash of a type, the same for its copies in the other units
+  // (see DeduplicateTypes)
+  struct TypeSummary {
+    uint64_t hash;
+    ElementType type;
+    uint64_t size;
+    bool declaration;
+  };
+  // Append the types of the elements added since first_element, a complete
+  // unit
+  void SummarizeTypes(size_t first_element, std::vector<TypeSummary>& types);
+  // Move the elements of other, complete units parsed by another builder,
+  // after the elements of this one, and deduplicate them unit by unit like
+  // DeduplicateTypes. unit_ends gives the element count of other after each
+  // unit. The scopes of other are interned again, in their order, so the
+  // result is the same as parsing the units with this builder.
+  void AppendUnits(TreeBuilder& other, const std::vector<size_t>& unit_ends, TypeTable& type_table);
+  // Remove the declarations of the types, and replace the references to them
+  // by the definition they are linked to, or else the definition, or the
+  // first declaration, with the same name. The references to the
+  // deduplicated types are replaced too, and so are the ids given.
+  void MergeTypes(std::vector<uint64_t>* ids = nullptr);
+  // Remove the elements which are not referenced, directly or not, by the
+  // types of ids, like LoadIndexedTypes selects them
+  void KeepReferencedTypes(const std::vector<uint64_t>& ids);
+
+  // Compact binary form of the elements added since first_element, a complete
+  // unit of unit_size bytes. The ids are saved relative to the unit, and the
+  // references to the type units by signature: signatures gives the signature
+  // of their type DIE. False for the other references outside of the unit.
+  // The strings saved, by content, are appended to strings.
+  bool SaveElements(size_t first_element, uint64_t unit_offset, uint64_t unit_size,
+                    const std::unordered_map<uint64_t, uint64_t>& signatures, std::string& data,
+                    std::vector<const char*>& strings) const;
+  // Append the elements saved by SaveElements, for the same unit now at
+  // unit_offset. type_signatures gives the type DIE of each signature. False
+  // if the data is invalid, nothing is added then.
+  bool LoadElements(std::vector<char> data, uint64_t unit_offset, uint64_t unit_size,
+                    const std::unordered_map<uint64_t, uint64_t>& type_signatures);
+
+  // Content of the index file of the elements, see TypeIndex
+  bool SaveIndex(std::string& data);
+  // Append the elements of index at the indexes of roots, and the types they
+  // reference. Their names point in the index.
+  void LoadIndexedTypes(const TypeIndex& index, const std::vector<uint32_t>& roots);
+
 private:
   static std::string EscapeJsonString(const char* str);
 
+  // Names of the output. The names of the sections are found by address,
+  // i.e. by offset in .debug_str, the others (inline strings, scopes) are
+  // hashed once per address.
+  class StringTable {
+  public:
+    uint32_t Intern(const char* str);
+    std::string GenerateJson() const;
+  private:
+    std::unordered_map<const char*, uint32_t> ids_by_address_;
+    std::unordered_map<std::string_view, uint32_t> ids_by_content_;
+    std::vector<const char*> strings_;
+  };
+
+  struct JsonContext {
+    StringTable* strings;                                     // With a string table
+    const std::unordered_map<uint64_t, uint32_t>* dense_ids;  // With dense ids
+  };
+  // Quoted name, or its index in the string table
+  static std::string JsonName(const JsonContext& context, const char* name);
+  // Quoted id, or its dense id. False when the element isn't in the output.
+  static bool JsonId(const JsonContext& context, uint64_t id, std::string& json_id);
+
+  struct Member {
+    uint64_t id;
+    const char* name;
+    uint64_t size;
+    uint64_t type_id;
+    uint64_t offset;
+  };
+
   struct Parent {
     uint64_t id;
     size_t offset;
   };
 
-  class Element {
-  public:
-    Element(ElementType type, uint64_t id) : type_(type), id_(id), 
-      name_(nullptr), size_(0), type_id_(0), offset_(0), count_(0) {}
-    const char* TypeName();
-    std::string GenerateJson();
-    ElementType type_;
-    uint64_t id_;
-    const char* name_;
-    size_t size_;
-    uint64_t type_id_;
-    uint64_t offset_;
-    uint64_t count_;
-    std::vector<Element> members_;
-    std::vector<Parent> parents_;
-  };
-
-  std::vector<Element> elements_;
-  std::vector<size_t> nested_elements_; // Stack of elements_ index to know parents elements
-  ElementType last_parsed_type_;
+  // Members or parents of an element in members_ or parents_
+  struct Range {
+    uint32_t first;
+    uint32_t count;
+  };
+
+  // The elements are stored by column, the members and the parents of all
+  // the elements in shared arrays
+  struct Elements {
+    explicit Elements(Arena* arena);
+
+    ArenaArray<ElementType> types;
+    ArenaArray<uint64_t> ids;
+    ArenaArray<const char*> names;
+    ArenaArray<uint64_t> sizes;
+    ArenaArray<uint64_t> type_ids;
+    ArenaArray<uint64_t> counts;
+    ArenaArray<uint32_t> scopes;
+    ArenaArray<bool> declarations;
+    ArenaArray<Range> members;
+    ArenaArray<Range> parents;
+
+    size_t size() const { return ids.size(); }
+    bool empty() const { return ids.empty(); }
+    void Add(ElementType type, uint64_t id);
+    // Remove the elements from index size
+    void Truncate(size_t size);
+    // Overwrite the element at index to with the one at from
+    void Move(size_t from, size_t to);
+  };
+  static const char* ElementTypeName(ElementType type);
+  std::string ElementJson(const JsonContext& context, size_t element, const char* scope_name) const;
+  static std::string MemberJson(const JsonContext& context, const Member& member);
+
+  // Element whose children are being added, and its first member and parent
+  // in open_members_ and open_parents_
+  struct Level {
+    size_t element;
+    size_t first_member;
+    size_t first_parent;
+  };
+  // Last member or parent of the current element, nullptr if it has none.
+  // field is the one set, for the error.
+  Member* OpenMember(const char* field);
+  Parent* OpenParent(const char* field);
+  // Store the open members and parents of the last level in its element
+  void CloseLevel();
+  // Move the members and the parents of the elements from first_element to
+  // first_member and first_parent, the other ones after them are removed
+  void CompactRanges(size_t first_element, size_t first_member, size_t first_parent);
+
+  struct TypeName {
+    size_t element;
+    uint32_t scope;
+    const char* name;       // nullptr for an unnamed declaration with a link
+    bool declaration;
+    uint64_t link;          // See SetElementScope
+  };
+
+  struct Scope {
+    uint32_t parent;
+    const char* name;         // nullptr for an anonymous namespace
+    uint64_t unit;            // Unit of an anonymous namespace
+  };
+  struct ScopeKey {
+    uint32_t parent;
+    uint64_t unit;
+    std::string_view name;
+    bool operator==(const ScopeKey& other) const {
+      return parent == other.parent && unit == other.unit && name == other.name;
+    }
+  };
+  struct ScopeKeyHash {
+    size_t operator()(const ScopeKey& key) const {
+      return std::hash<std::string_view>()(key.name) ^ (key.parent * 0x9e3779b97f4a7c15ULL) ^ key.unit;
+    }
+  };
+
+  // Types of the unit being deduplicated
+  struct UnitTypes {
+    size_t first_element;
+    std::vector<std::pair<uint64_t, size_t>> elements;  // Sorted by id
+    std::vector<uint64_t> hashes;                       // By element - first_element
+    std::vector<uint8_t> states;
+    std::vector<uint64_t> links;                        // By element - first_element
+  };
+  void InitUnitTypes(size_t first_element, UnitTypes& unit) const;
+  size_t FindUnitType(const UnitTypes& unit, uint64_t id) const;
+  uint64_t TypeHash(UnitTypes& unit, size_t element);
+  uint64_t ReferenceHash(UnitTypes& unit, uint64_t id);
+  // Same fields, members and parents, for the types with the same hash
+  bool SameStructure(size_t element, size_t other) const;
+
+  // The elements, their members and parents, the maps and the stacks filled
+  // while parsing are allocated in the arena, and freed with the builder
+  std::unique_ptr<Arena> arena_;
+  Elements elements_;
+  ArenaArray<Member> members_;
+  ArenaArray<Parent> parents_;
+  ArenaArray<TypeName> type_names_;
+  // Removed type to its replacement
+  std::unordered_map<uint64_t, uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>, 
+                     ArenaAllocator<std::pair<const uint64_t, uint64_t>>> replaced_ids_;
+  ArenaArray<Scope> scopes_;
+  std::unordered_map<ScopeKey, uint32_t, ScopeKeyHash, std::equal_to<ScopeKey>, 
+                     ArenaAllocator<std::pair<const ScopeKey, uint32_t>>> scope_ids_;
+  std::vector<std::string> scope_names_;  // Qualified names of scopes_, built for the output
+  std::vector<std::vector<char>> loaded_data_;  // Loaded elements, their names point in it
+  ArenaArray<Level> nested_elements_;  // Stack of elements_ index to know parents elements
+  // Members and parents of the elements of nested_elements_, the ones of an
+  // element follow the ones of its parent elements
+  ArenaArray<Member> open_members_;
+  ArenaArray<Parent> open_parents_;
+  ElementType last_parsed_type_ = ElementType::none;
 };
\ No newline at end of file
@@ -0,0 +1,177 @@
+#include "TypeIndex.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hash.h"
+
+
+const char TypeIndex::kMagic[8] = {'D', 'D', 'I', 'N', 'D', 'E', 'X', '1'};
+
+TypeIndex::~TypeIndex() {
+  if (data_) {
+    munmap(data_, size_);
+  }
+}
+
+// static
+uint32_t TypeIndex::Hash(const char* name) {
+  return static_cast<uint32_t>(HashFinalize(HashBytes(0, name, strlen(name))));
+}
+
+// static
+bool TypeIndex::Write(const std::string& path, const std::string& data) {
+  FILE* hfile = fopen(path.c_str(), "wb");
+  if (!hfile) {
+    fprintf(stderr, "ERR: Can't create the index '%s'\n", path.c_str());
+    return false;
+  }
+  bool written = fwrite(data.data(), 1, data.size(), hfile) == data.size();
+  written &= fclose(hfile) == 0;
+  if (!written) {
+    fprintf(stderr, "ERR: Can't write the index '%s'\n", path.c_str());
+  }
+  return written;
+}
+
+template <typename Entry>
+const Entry* TypeIndex::Array(uint64_t offset, uint64_t count) const {
+  if (offset % alignof(Entry) || offset > size_ || count > (size_ - offset) / sizeof(Entry)) {
+    return nullptr;
+  }
+  return reinterpret_cast<const Entry*>(data_ + offset);
+}
+
+bool TypeIndex::Open(const std::string& path) {
+  // Mapped read only: the processes querying the same index share its pages
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "ERR: Failed to open '%s'\n", path.c_str());
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) < 0 || static_cast<size_t>(file_stat.st_size) < sizeof(Header)) {
+    fprintf(stderr, "ERR: Invalid index '%s'\n", path.c_str());
+    close(fd);
+    return false;
+  }
+  size_ = file_stat.st_size;
+  void* mapping = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    fprintf(stderr, "ERR: Failed to map '%s'\n", path.c_str());
+    size_ = 0;
+    return false;
+  }
+  data_ = reinterpret_cast<unsigned char*>(mapping);
+
+  // Only the bounds of the arrays are checked here, not their content
+  header_ = reinterpret_cast<const Header*>(data_);
+  if (memcmp(header_->magic, kMagic, sizeof(kMagic)) || !header_->bucket_count ||
+      (header_->bucket_count & (header_->bucket_count - 1))) {
+    fprintf(stderr, "ERR: Invalid index '%s'\n", path.c_str());
+    return false;
+  }
+  elements_ = Array<Element>(header_->elements, header_->element_count);
+  members_ = Array<Member>(header_->members, header_->member_count);
+  parents_ = Array<Parent>(header_->parents, header_->parent_count);
+  buckets_ = Array<uint32_t>(header_->buckets, static_cast<uint64_t>(header_->bucket_count) + 1);
+  if (buckets_) {
+    name_count_ = buckets_[header_->bucket_count];
+    names_ = Array<Name>(header_->names, name_count_);
+  }
+  strings_ = Array<char>(header_->strings, header_->strings_size);
+  if (!elements_ || !members_ || !parents_ || !names_ || !strings_ ||
+      !header_->strings_size || strings_[header_->strings_size - 1]) {
+    fprintf(stderr, "ERR: Truncated index '%s'\n", path.c_str());
+    return false;
+  }
+  return true;
+}
+
+const TypeIndex::Element* TypeIndex::GetElement(uint32_t index) const {
+  return index < header_->element_count ? &elements_[index] : nullptr;
+}
+
+const TypeIndex::Member* TypeIndex::GetMembers(const Element& element) const {
+  if (element.first_member > header_->member_count ||
+      element.member_count > header_->member_count - element.first_member) {
+    return nullptr;
+  }
+  return members_ + element.first_member;
+}
+
+const TypeIndex::Parent* TypeIndex::GetParents(const Element& element) const {
+  if (element.first_parent > header_->parent_count ||
+      element.parent_count > header_->parent_count - element.first_parent) {
+    return nullptr;
+  }
+  return parents_ + element.first_parent;
+}
+
+const char* TypeIndex::GetString(uint32_t offset) const {
+  // The strings end with a NUL byte
+  return offset < header_->strings_size ? strings_ + offset : nullptr;
+}
+
+// static
+bool TypeIndex::SplitTypeName(const std::string& type_name, std::string& scope_name, std::string& name) {
+  // The last "::" outside of the template arguments
+  size_t name_begin = 0;
+  int template_depth = 0;
+  for (size_t i = 0; i < type_name.size(); i++) {
+    if (type_name[i] == '<') {
+      template_depth++;
+    } else if (type_name[i] == '>') {
+      template_depth--;
+    } else if (!template_depth && type_name.compare(i, 2, "::") == 0) {
+      name_begin = i + 2;
+    }
+  }
+  name = type_name.substr(name_begin);
+  scope_name = name_begin ? type_name.substr(0, name_begin - 2) : "";
+  return name_begin != 0;
+}
+
+// static
+bool TypeIndex::MatchScopeName(const std::string& element_scope_name, const std::string& scope_name) {
+  // The scope given can omit the first scopes (the crate namespace of Rust),
+  // unless it starts with ::
+  if (scope_name.compare(0, 2, "::") == 0) {
+    return element_scope_name.compare(0, std::string::npos, scope_name, 2, std::string::npos) == 0;
+  }
+  if (scope_name.empty() || element_scope_name.size() < scope_name.size()) {
+    return element_scope_name == scope_name;
+  }
+  size_t begin = element_scope_name.size() - scope_name.size();
+  return element_scope_name.compare(begin, std::string::npos, scope_name) == 0 && 
+         (begin == 0 || element_scope_name.compare(begin - 2, 2, "::") == 0);
+}
+
+void TypeIndex::Lookup(const std::string& name, std::vector<uint32_t>& elements) const {
+  // A qualified name matches the scopes like --find on the DIEs, the local
+  // types are in none
+  std::string scope;
+  std::string unqualified_name;
+  bool qualified = SplitTypeName(name, scope, unqualified_name);
+
+  uint32_t hash = Hash(unqualified_name.c_str());
+  uint32_t bucket = hash & (header_->bucket_count - 1);
+  for (uint32_t i = buckets_[bucket]; i < buckets_[bucket + 1] && i < name_count_; i++) {
+    if (names_[i].hash != hash) {
+      continue;
+    }
+    const Element* element = GetElement(names_[i].element);
+    const char* element_name = element ? GetString(element->name) : nullptr;
+    if (!element_name || unqualified_name != element_name) {
+      continue;
+    }
+    const char* element_scope = GetString(element->scope);
+    if (qualified && (element->local || !MatchScopeName(element_scope ? element_scope : "", scope))) {
+      continue;
+    }
+    elements.push_back(names_[i].element);
+  }
+}
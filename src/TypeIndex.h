@@ -0,0 +1,109 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+// Index file of the dumped types, written once and queried in place: the file
+// is mapped, its arrays are read without being loaded. All the offsets are
+// from the beginning of the file, the arrays are aligned on 8 bytes.
+class TypeIndex {
+public:
+  static const uint32_t kNone = UINT32_MAX;   // No name, or type not indexed
+
+  struct Header {
+    char magic[8];
+    uint32_t element_count;
+    uint32_t member_count;
+    uint32_t parent_count;
+    uint32_t bucket_count;    // Power of 2
+    uint64_t elements;        // Element[element_count]
+    uint64_t members;         // Member[member_count]
+    uint64_t parents;         // Parent[parent_count]
+    uint64_t buckets;         // uint32_t[bucket_count + 1], first name of each bucket
+    uint64_t names;           // Name[], the named elements sorted by bucket
+    uint64_t strings;         // NUL terminated strings
+    uint64_t strings_size;
+  };
+
+  struct Element {
+    uint64_t id;              // DIE offset
+    uint64_t type_id;
+    uint64_t size;
+    uint64_t count;
+    uint32_t type_index;      // Index of type_id in the elements, or kNone
+    uint32_t name;            // Offset in the strings, or kNone
+    uint32_t scope;           // Qualified name of the scope, or kNone
+    uint32_t first_member;
+    uint32_t member_count;
+    uint32_t first_parent;
+    uint32_t parent_count;
+    uint8_t type;             // TreeBuilder::ElementType
+    uint8_t declaration;
+    uint8_t local;            // Type of a function or a block, in no scope
+    uint8_t padding;
+  };
+
+  struct Member {
+    uint64_t type_id;
+    uint64_t offset;
+    uint32_t type_index;
+    uint32_t name;
+  };
+
+  struct Parent {
+    uint64_t id;
+    uint64_t offset;
+    uint32_t type_index;
+    uint32_t padding;
+  };
+
+  struct Name {
+    uint32_t hash;
+    uint32_t element;
+  };
+
+  TypeIndex() = default;
+  ~TypeIndex();
+  TypeIndex(const TypeIndex&) = delete;
+  TypeIndex& operator=(const TypeIndex&) = delete;
+
+  bool Open(const std::string& path);
+  static bool Write(const std::string& path, const std::string& data);
+  static uint32_t Hash(const char* name);
+  static const char kMagic[8];
+
+  uint32_t ElementCount() const { return header_->element_count; }
+  // The accessors check the indexes and the offsets read in the file, they
+  // return nullptr when they are invalid
+  const Element* GetElement(uint32_t index) const;
+  const Member* GetMembers(const Element& element) const;
+  const Parent* GetParents(const Element& element) const;
+  const char* GetString(uint32_t offset) const;
+  // Append the elements named name. A qualified name (a::b::Foo) only matches
+  // the types of the scopes ending with this scope, see MatchScopeName.
+  void Lookup(const std::string& name, std::vector<uint32_t>& elements) const;
+  // Split a qualified name at its last "::" outside of the template
+  // arguments, false if it has none
+  static bool SplitTypeName(const std::string& type_name, std::string& scope_name, std::string& name);
+  // Whether the qualified name of a scope ends with scope_name, or is
+  // scope_name when it starts with "::"
+  static bool MatchScopeName(const std::string& element_scope_name, const std::string& scope_name);
+
+
+private:
+  template <typename Entry>
+  const Entry* Array(uint64_t offset, uint64_t count) const;
+
+  unsigned char* data_ = nullptr;
+  size_t size_ = 0;
+  const Header* header_ = nullptr;
+  const Element* elements_ = nullptr;
+  const Member* members_ = nullptr;
+  const Parent* parents_ = nullptr;
+  const uint32_t* buckets_ = nullptr;
+  const Name* names_ = nullptr;
+  uint32_t name_count_ = 0;
+  const char* strings_ = nullptr;
+};
@@ -0,0 +1,149 @@
+#include "TypeStatistics.h"
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+
+
+namespace {
+  // Student's t for a 95% confidence interval, by degrees of freedom: the
+  // jackknife of g groups has g - 1
+  const double kStudentT95[] = {0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262};
+}
+
+void TypeStatistics::AddUnit(const std::vector<TreeBuilder::TypeSummary>& types) {
+  SampledUnit unit = {};
+  for (const TreeBuilder::TypeSummary& type : types) {
+    if (type.declaration) {
+      continue;
+    }
+    unit.types++;
+    bool structure = type.type == TreeBuilder::ElementType::structure_type ||
+                     type.type == TreeBuilder::ElementType::class_type;
+    unit.distinct_types.push_back({type.hash, type.size, structure});
+  }
+  std::sort(unit.distinct_types.begin(), unit.distinct_types.end(),
+            [](const UnitType& a, const UnitType& b) { return a.hash < b.hash; });
+  unit.distinct_types.erase(std::unique(unit.distinct_types.begin(), unit.distinct_types.end(),
+                                        [](const UnitType& a, const UnitType& b) { return a.hash == b.hash; }),
+                            unit.distinct_types.end());
+  units_.push_back(std::move(unit));
+}
+
+TypeStatistics::HashUnits TypeStatistics::CountHashUnits(size_t group_count) const {
+  HashUnits hash_units;
+  for (size_t i = 0; i < units_.size(); i++) {
+    for (const UnitType& type : units_[i].distinct_types) {
+      std::array<uint32_t, kGroups + 1>& counts = hash_units[type.hash];
+      counts[i % group_count]++;
+      counts[kGroups]++;
+    }
+  }
+  return hash_units;
+}
+
+TypeStatistics::Totals TypeStatistics::Extrapolate(const HashUnits& hash_units, size_t group_count, 
+                                                   size_t excluded_group) const {
+  uint64_t sampled = 0;
+  for (size_t i = 0; i < units_.size(); i++) {
+    sampled += i % group_count != excluded_group;
+  }
+
+  // A type of a unit found in k of the n sampled units is in about
+  // 1 + (k - 1) * (N - 1) / (n - 1) of the N units
+  Totals totals = {};
+  for (size_t i = 0; i < units_.size(); i++) {
+    if (i % group_count == excluded_group) {
+      continue;
+    }
+    totals.types += units_[i].types;
+    for (const UnitType& type : units_[i].distinct_types) {
+      const std::array<uint32_t, kGroups + 1>& counts = hash_units.find(type.hash)->second;
+      uint64_t other_units = counts[kGroups] - 1 - (excluded_group < kGroups ? counts[excluded_group] : 0);
+      double units = 1;
+      if (sampled > 1) {
+        units += static_cast<double>(other_units) * (unit_count_ - 1) / (sampled - 1);
+      }
+      totals.distinct_types += 1 / units;
+      if (type.structure) {
+        totals.structures += 1 / units;
+        totals.structure_bytes += type.size / units;
+      }
+    }
+  }
+  double scale = sampled ? static_cast<double>(unit_count_) / sampled : 0;
+  totals.types *= scale;
+  totals.distinct_types *= scale;
+  totals.structures *= scale;
+  totals.structure_bytes *= scale;
+  return totals;
+}
+
+std::string TypeStatistics::GenerateJson() const {
+  // The statistics derived from the totals
+  const size_t kStatisticCount = 5;
+  auto statistics = [](const Totals& totals) {
+    std::array<double, kStatisticCount> values = {
+      totals.types,
+      totals.distinct_types,
+      totals.types ? 1 - totals.distinct_types / totals.types : 0,
+      totals.structures,
+      totals.structures ? totals.structure_bytes / totals.structures : 0
+    };
+    return values;
+  };
+  static const struct {
+    const char* name;
+    const char* format;
+    double max;
+  } kStatistics[kStatisticCount] = {
+    {"types", "%.0f", HUGE_VAL},
+    {"distinct_types", "%.0f", HUGE_VAL},
+    {"duplication_ratio", "%.4f", 1},
+    {"structures", "%.0f", HUGE_VAL},
+    {"average_structure_size", "%.1f", HUGE_VAL},
+  };
+
+  size_t group_count = std::max<size_t>(1, std::min(kGroups, units_.size()));
+  HashUnits hash_units = CountHashUnits(group_count);
+  std::array<double, kStatisticCount> estimates = statistics(Extrapolate(hash_units, group_count, kGroups));
+
+  // Jackknife variance, reduced by the share of the units sampled
+  std::array<double, kStatisticCount> half_widths = {};
+  if (group_count > 1) {
+    std::vector<std::array<double, kStatisticCount>> replicates;
+    std::array<double, kStatisticCount> means = {};
+    for (size_t group = 0; group < group_count; group++) {
+      replicates.push_back(statistics(Extrapolate(hash_units, group_count, group)));
+      for (size_t i = 0; i < kStatisticCount; i++) {
+        means[i] += replicates.back()[i] / group_count;
+      }
+    }
+    double unsampled_share = 1 - static_cast<double>(units_.size()) / unit_count_;
+    for (size_t i = 0; i < kStatisticCount; i++) {
+      double variance = 0;
+      for (const std::array<double, kStatisticCount>& replicate : replicates) {
+        variance += (replicate[i] - means[i]) * (replicate[i] - means[i]);
+      }
+      variance *= unsampled_share * (group_count - 1) / group_count;
+      half_widths[i] = kStudentT95[group_count - 1] * sqrt(std::max(0.0, variance));
+    }
+  }
+
+  std::string json = "{\"units\":" + std::to_string(unit_count_) +
+                     ",\"sampled_units\":" + std::to_string(units_.size());
+  char value[64];
+  for (size_t i = 0; i < kStatisticCount; i++) {
+    json += std::string(",\"") + kStatistics[i].name + "\":{\"estimate\":";
+    snprintf(value, sizeof(value), kStatistics[i].format, estimates[i]);
+    json += value;
+    // Without an interval when a single unit is sampled
+    if (group_count > 1) {
+      snprintf(value, sizeof(value), kStatistics[i].format, std::max(0.0, estimates[i] - half_widths[i]));
+      json += std::string(",\"low\":") + value;
+      snprintf(value, sizeof(value), kStatistics[i].format, std::min(kStatistics[i].max, estimates[i] + half_widths[i]));
+      json += std::string(",\"high\":") + value;
+    }
+    json += "}";
+  }
+  return json + "}";
+}
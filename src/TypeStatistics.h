@@ -0,0 +1,58 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "TreeBuilder.h"
+
+
+// Statistics of the types of all the units, extrapolated from a uniform
+// random sample of them. The copies of a type in several units are counted
+// once in distinct_types: each copy counts for 1 / the number of units having
+// it, estimated from the other sampled units. The declarations are not
+// counted. The confidence intervals (95%) come from a delete-a-group
+// jackknife of the sampled units.
+class TypeStatistics {
+public:
+  explicit TypeStatistics(uint64_t unit_count) : unit_count_(unit_count) {}
+
+  // Types of the next sampled unit, empty if it has none or is filtered out
+  void AddUnit(const std::vector<TreeBuilder::TypeSummary>& types);
+  std::string GenerateJson() const;
+
+
+private:
+  static constexpr size_t kGroups = 10;   // Of the jackknife
+
+  struct UnitType {
+    uint64_t hash;
+    uint64_t size;
+    bool structure;
+  };
+  // Types of a sampled unit, each copy of a type in the unit counts
+  struct SampledUnit {
+    uint64_t types;
+    std::vector<UnitType> distinct_types; // Sorted by hash
+  };
+
+  // Number of sampled units of each group having a type, the last one is the
+  // number of all the sampled units having it. The units are assigned to the
+  // groups in turn.
+  typedef std::unordered_map<uint64_t, std::array<uint32_t, kGroups + 1>> HashUnits;
+  HashUnits CountHashUnits(size_t group_count) const;
+
+  // Sums over the sampled units, scaled to all the units
+  struct Totals {
+    double types;
+    double distinct_types;
+    double structures;
+    double structure_bytes;
+  };
+  // Without the units of excluded_group, all of them for kGroups
+  Totals Extrapolate(const HashUnits& hash_units, size_t group_count, size_t excluded_group) const;
+
+  uint64_t unit_count_;
+  std::vector<SampledUnit> units_;
+};
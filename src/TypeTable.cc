@@ -0,0 +1,11 @@
+#include "TypeTable.h"
+
+
+TypeTable::TypeTable()
+  : elements_(0, std::hash<uint64_t>(), std::equal_to<uint64_t>(), 
+              ArenaAllocator<std::pair<const uint64_t, uint64_t>>(&arena_)) {
+}
+
+uint64_t& TypeTable::Insert(uint64_t hash, uint64_t element) {
+  return elements_.emplace(hash, element)->second;
+}
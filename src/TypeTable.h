@@ -0,0 +1,31 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include "Arena.h"
+
+
+// Canonical elements of the types of all the units, by structural type hash.
+// The elements with the same hash are only candidates: TreeBuilder compares
+// their structure, so a hash collision keeps several canonical elements. The
+// units parsed by several threads are deduplicated by the thread merging
+// them, so the table isn't locked.
+class TypeTable {
+public:
+  typedef std::unordered_multimap<uint64_t, uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>,
+                                  ArenaAllocator<std::pair<const uint64_t, uint64_t>>> Elements;
+
+  TypeTable();
+
+  // Canonical elements with this hash
+  std::pair<Elements::const_iterator, Elements::const_iterator> Candidates(uint64_t hash) const {
+    return elements_.equal_range(hash);
+  }
+  // Add a canonical element, the reference stays valid to move it
+  uint64_t& Insert(uint64_t hash, uint64_t element);
+
+
+private:
+  Arena arena_;
+  Elements elements_;
+};
@@ -0,0 +1,60 @@
+#include "UnitCache.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <atomic>
+
+
+bool UnitCache::Open()
+{
+  if (mkdir(directory_.c_str(), 0755) < 0 && errno != EEXIST) {
+    fprintf(stderr, "ERR: Can't create the cache directory '%s'\n", directory_.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::string UnitCache::Path(uint64_t key) const
+{
+  char name[32];
+  snprintf(name, sizeof(name), "/%016" PRIx64 ".unit", key);
+  return directory_ + name;
+}
+
+bool UnitCache::Load(uint64_t key, std::vector<char>& data) const
+{
+  int fd = open(Path(key).c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat file_stat;
+  bool loaded = fstat(fd, &file_stat) == 0 && file_stat.st_size > 0;
+  if (loaded) {
+    data.resize(file_stat.st_size);
+    loaded = read(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size());
+  }
+  close(fd);
+  return loaded;
+}
+
+void UnitCache::Store(uint64_t key, const std::string& data) const
+{
+  // The file is renamed once complete: a concurrent run never reads a
+  // partial file. The threads of a run write different temporary files.
+  static std::atomic<uint32_t> temp_count(0);
+  std::string path = Path(key);
+  std::string temp_path = path + "." + std::to_string(getpid()) + "." + std::to_string(temp_count++);
+  int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return;
+  }
+  bool written = write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size());
+  written &= close(fd) == 0;
+  if (!written || rename(temp_path.c_str(), path.c_str()) < 0) {
+    unlink(temp_path.c_str());
+  }
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+// Parsed elements of the units dumped by the previous runs. The directory
+// contains one file per unit, named by the hash of its content: a unit which
+// didn't change is found again even if it moved in the binary. The files are
+// never removed, any of them can be deleted between two runs.
+class UnitCache {
+public:
+  explicit UnitCache(const std::string& directory) : directory_(directory) {}
+
+  // Create the directory if it doesn't exist
+  bool Open();
+  // Content stored for key, false if there is none
+  bool Load(uint64_t key, std::vector<char>& data) const;
+  void Store(uint64_t key, const std::string& data) const;
+
+
+private:
+  std::string Path(uint64_t key) const;
+
+  std::string directory_;
+};
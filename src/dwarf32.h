@@ -9,6 +9,45 @@ namespace Dwarf32 {
     uint8_t  address_size;
   } __attribute__((packed, aligned(1)));
 
+  // DWARF 5 moved address_size before abbrev_offset and added unit_type
+  struct CompilationUnitHdr5 {
+    uint32_t unit_length;
+    uint16_t version;
+    uint8_t  unit_type;
+    uint8_t  address_size;
+    uint32_t abbrev_offset;
+  } __attribute__((packed, aligned(1)));
+
+  // DWARF64 units start with an escape value in place of the 32-bit length,
+  // followed by the 64-bit length. All the section offsets are then 64-bit.
+  const uint32_t kDwarf64Escape = 0xffffffff;
+
+  struct CompilationUnitHdr64 {
+    uint32_t dwarf64_escape;
+    uint64_t unit_length;
+    uint16_t version;
+    uint64_t abbrev_offset;
+    uint8_t  address_size;
+  } __attribute__((packed, aligned(1)));
+
+  struct CompilationUnitHdr5_64 {
+    uint32_t dwarf64_escape;
+    uint64_t unit_length;
+    uint16_t version;
+    uint8_t  unit_type;
+    uint8_t  address_size;
+    uint64_t abbrev_offset;
+  } __attribute__((packed, aligned(1)));
+
+  enum UnitType {
+    DW_UT_compile = 0x01,
+    DW_UT_type = 0x02,
+    DW_UT_partial = 0x03,
+    DW_UT_skeleton = 0x04,
+    DW_UT_split_compile = 0x05,
+    DW_UT_split_type = 0x06
+  };
+
   enum Tag {
     DW_TAG_padding = 0x00,
     DW_TAG_array_type = 0x01,
@@ -77,7 +116,14 @@ namespace Dwarf32 {
     DW_TAG_template_alias = 0x43,
 
     // DWARF 5
+    DW_TAG_coarray_type = 0x44,
+    DW_TAG_generic_subrange = 0x45,
+    DW_TAG_dynamic_type = 0x46,
     DW_TAG_atomic_type = 0x47,
+    DW_TAG_call_site = 0x48,
+    DW_TAG_call_site_parameter = 0x49,
+    DW_TAG_skeleton_unit = 0x4a,
+    DW_TAG_immutable_type = 0x4b,
 
     DW_TAG_lo_user = 0x4080,
     DW_TAG_hi_user = 0xffff
@@ -185,7 +231,35 @@ namespace Dwarf32 {
     DW_AT_linkage_name = 0x6e,
 
     // DWARF 5
+    DW_AT_string_length_bit_size = 0x6f,
+    DW_AT_string_length_byte_size = 0x70,
+    DW_AT_rank = 0x71,
+    DW_AT_str_offsets_base = 0x72,
+    DW_AT_addr_base = 0x73,
+    DW_AT_rnglists_base = 0x74,
+    DW_AT_dwo_name = 0x76,
+    DW_AT_reference = 0x77,
+    DW_AT_rvalue_reference = 0x78,
+    DW_AT_macros = 0x79,
+    DW_AT_call_all_calls = 0x7a,
+    DW_AT_call_all_source_calls = 0x7b,
+    DW_AT_call_all_tail_calls = 0x7c,
+    DW_AT_call_return_pc = 0x7d,
+    DW_AT_call_value = 0x7e,
+    DW_AT_call_origin = 0x7f,
+    DW_AT_call_parameter = 0x80,
+    DW_AT_call_pc = 0x81,
+    DW_AT_call_tail_call = 0x82,
+    DW_AT_call_target = 0x83,
+    DW_AT_call_target_clobbered = 0x84,
+    DW_AT_call_data_location = 0x85,
+    DW_AT_call_data_value = 0x86,
     DW_AT_noreturn = 0x87,
+    DW_AT_alignment = 0x88,
+    DW_AT_export_symbols = 0x89,
+    DW_AT_deleted = 0x8a,
+    DW_AT_defaulted = 0x8b,
+    DW_AT_loclists_base = 0x8c,
 
     DW_AT_lo_user = 0x2000,
     DW_AT_hi_user = 0x3fff
@@ -218,7 +292,71 @@ namespace Dwarf32 {
     DW_FORM_sec_offset,     // lineptr...
     DW_FORM_exprloc,        // exprloc
     DW_FORM_flag_present,   // flag
-    DW_FORM_ref_sig8        // reference
+    DW_FORM_ref_sig8 = 0x20, // reference
+
+    // DWARF 5
+    DW_FORM_strx = 0x1a,    // string
+    DW_FORM_addrx,          // address
+    DW_FORM_ref_sup4,       // reference
+    DW_FORM_strp_sup,       // string
+    DW_FORM_data16,         // constant
+    DW_FORM_line_strp,      // string
+    DW_FORM_implicit_const = 0x21, // constant
+    DW_FORM_loclistx,       // loclist
+    DW_FORM_rnglistx,       // rnglist
+    DW_FORM_ref_sup8,       // reference
+    DW_FORM_strx1,          // string
+    DW_FORM_strx2,          // string
+    DW_FORM_strx3,          // string
+    DW_FORM_strx4,          // string
+    DW_FORM_addrx1,         // address
+    DW_FORM_addrx2,         // address
+    DW_FORM_addrx3,         // address
+    DW_FORM_addrx4,         // address
+
+    // GNU extensions (split DWARF and dwz)
+    DW_FORM_GNU_addr_index = 0x1f01,  // address
+    DW_FORM_GNU_str_index = 0x1f02,   // string
+    DW_FORM_GNU_ref_alt = 0x1f20,     // reference
+    DW_FORM_GNU_strp_alt = 0x1f21     // string
+  };
+
+  // Attributes of the .debug_names entries
+  enum NameIndex {
+    DW_IDX_compile_unit = 0x01,
+    DW_IDX_type_unit = 0x02,
+    DW_IDX_die_offset = 0x03,
+    DW_IDX_parent = 0x04,
+    DW_IDX_type_hash = 0x05,
+    DW_IDX_lo_user = 0x2000,
+    DW_IDX_hi_user = 0x3fff
+  };
+
+  // Only the operations of the member locations are needed
+  enum Operation {
+    DW_OP_plus_uconst = 0x23
+  };
+
+  // Only the languages accepted by the unit filters
+  enum Language {
+    DW_LANG_C89 = 0x01,
+    DW_LANG_C = 0x02,
+    DW_LANG_C_plus_plus = 0x04,
+    DW_LANG_Fortran90 = 0x08,
+    DW_LANG_C99 = 0x0c,
+    DW_LANG_ObjC = 0x10,
+    DW_LANG_ObjC_plus_plus = 0x11,
+    DW_LANG_Go = 0x16,
+    DW_LANG_C_plus_plus_03 = 0x19,
+    DW_LANG_C_plus_plus_11 = 0x1a,
+    DW_LANG_Rust = 0x1c,
+    DW_LANG_C11 = 0x1d,
+    DW_LANG_Swift = 0x1e,
+    DW_LANG_C_plus_plus_14 = 0x21,
+    DW_LANG_C_plus_plus_17 = 0x2a,
+    DW_LANG_C_plus_plus_20 = 0x2b,
+    DW_LANG_C17 = 0x2c,
+    DW_LANG_Mips_Assembler = 0x8001
   };
 
   enum Accessibility {
@@ -0,0 +1,34 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Hashes which don't depend on the process: they identify the results kept
+// between the runs.
+
+inline uint64_t HashMix(uint64_t hash, uint64_t value) {
+  hash = (hash ^ value) * 0x9e3779b97f4a7c15ULL;
+  return hash ^ (hash >> 29);
+}
+
+// Bytes of any alignment, read 8 at a time
+inline uint64_t HashBytes(uint64_t hash, const void* data, size_t size) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (; size >= sizeof(uint64_t); bytes += sizeof(uint64_t), size -= sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    hash = HashMix(hash, word);
+  }
+  uint64_t tail = 0;
+  for (size_t i = 0; i < size; i++) {
+    tail |= static_cast<uint64_t>(bytes[i]) << (i * 8);
+  }
+  return HashMix(HashMix(hash, tail), size);
+}
+
+// Spread all the bits of the hash, before using it as a key
+inline uint64_t HashFinalize(uint64_t hash) {
+  hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+  return hash ^ (hash >> 31);
+}
@@ -1,27 +1,314 @@
-// #include "MachOFile.h"
+#include "MachOFile.h"
 #include "ElfFile.h"
+#include "TypeIndex.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory>
+#include <set>
+#include <vector>
 
-int main(int argc, char* argv[]) {
-  if (argc < 2) {
-    fprintf(stderr, "Format: %s <binary_path> [arm64e|arm64|x86_64]\n", argv[0]);
-    return 1;
+static bool IsElfFile(const std::string& binary_path) {
+  FILE* hfile = fopen(binary_path.c_str(), "rb");
+  if (!hfile) {
+    return false;
+  }
+
+  unsigned char magic[4] = {};
+  size_t nb_read = fread(magic, sizeof(magic), 1, hfile);
+  fclose(hfile);
+  return nb_read == 1 && !memcmp(magic, "\x7f" "ELF", sizeof(magic));
+}
+
+// Names of the tags and attributes accepted by --tags and --attrs
+static const struct {
+  const char* name;
+  Dwarf32::Tag value;
+} kTagNames[] = {
+  {"struct", Dwarf32::Tag::DW_TAG_structure_type},
+  {"class", Dwarf32::Tag::DW_TAG_class_type},
+  {"union", Dwarf32::Tag::DW_TAG_union_type},
+  {"enum", Dwarf32::Tag::DW_TAG_enumeration_type},
+  {"typedef", Dwarf32::Tag::DW_TAG_typedef},
+  {"pointer", Dwarf32::Tag::DW_TAG_pointer_type},
+  {"const", Dwarf32::Tag::DW_TAG_const_type},
+  {"array", Dwarf32::Tag::DW_TAG_array_type},
+  {"base", Dwarf32::Tag::DW_TAG_base_type},
+  {"member", Dwarf32::Tag::DW_TAG_member},
+  {"inheritance", Dwarf32::Tag::DW_TAG_inheritance},
+  {"subrange", Dwarf32::Tag::DW_TAG_subrange_type},
+};
+
+static const struct {
+  const char* name;
+  Dwarf32::Attribute value;
+} kAttributeNames[] = {
+  {"name", Dwarf32::Attribute::DW_AT_name},
+  {"linkage_name", Dwarf32::Attribute::DW_AT_linkage_name},
+  {"byte_size", Dwarf32::Attribute::DW_AT_byte_size},
+  {"data_member_location", Dwarf32::Attribute::DW_AT_data_member_location},
+  {"type", Dwarf32::Attribute::DW_AT_type},
+  {"count", Dwarf32::Attribute::DW_AT_count},
+};
+
+// Names of the languages accepted by --languages, a name can select several
+// versions of the language
+static const struct {
+  const char* name;
+  Dwarf32::Language value;
+} kLanguageNames[] = {
+  {"c", Dwarf32::Language::DW_LANG_C89},
+  {"c", Dwarf32::Language::DW_LANG_C},
+  {"c", Dwarf32::Language::DW_LANG_C99},
+  {"c", Dwarf32::Language::DW_LANG_C11},
+  {"c", Dwarf32::Language::DW_LANG_C17},
+  {"c++", Dwarf32::Language::DW_LANG_C_plus_plus},
+  {"c++", Dwarf32::Language::DW_LANG_C_plus_plus_03},
+  {"c++", Dwarf32::Language::DW_LANG_C_plus_plus_11},
+  {"c++", Dwarf32::Language::DW_LANG_C_plus_plus_14},
+  {"c++", Dwarf32::Language::DW_LANG_C_plus_plus_17},
+  {"c++", Dwarf32::Language::DW_LANG_C_plus_plus_20},
+  {"objc", Dwarf32::Language::DW_LANG_ObjC},
+  {"objc++", Dwarf32::Language::DW_LANG_ObjC_plus_plus},
+  {"fortran", Dwarf32::Language::DW_LANG_Fortran90},
+  {"go", Dwarf32::Language::DW_LANG_Go},
+  {"rust", Dwarf32::Language::DW_LANG_Rust},
+  {"swift", Dwarf32::Language::DW_LANG_Swift},
+  {"asm", Dwarf32::Language::DW_LANG_Mips_Assembler},
+};
+
+// Split a comma separated list
+static std::vector<std::string> SplitList(const char* list) {
+  std::string names(list);
+  std::vector<std::string> items;
+  size_t begin = 0;
+  while (begin <= names.size()) {
+    size_t end = names.find(',', begin);
+    if (end == std::string::npos) {
+      end = names.size();
+    }
+    items.push_back(names.substr(begin, end - begin));
+    begin = end + 1;
+  }
+  return items;
+}
+
+// Parse a comma separated list of names into their values
+template <typename Table, typename Value>
+static bool ParseNameList(const char* list, const Table& table, std::set<Value>& values) {
+  for (const std::string& name : SplitList(list)) {
+    bool found = false;
+    for (const auto& entry : table) {
+      if (name == entry.name) {
+        values.insert(entry.value);
+        found = true;
+      }
+    }
+    if (!found) {
+      fprintf(stderr, "ERR: Unknown name '%s'\n", name.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+static void PrintUsage(const char* program) {
+  fprintf(stderr, "Format: %s [options] <binary_path> [arm64e|arm64|x86_64]\n", program);
+  fprintf(stderr, "        %s [options] --index <index_path>\n", program);
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  --find <type_name>  Only dump the types named type_name and their dependencies\n");
+  fprintf(stderr, "  --tags <tag,...>    Only dump these tags: struct, class, union, enum, typedef, pointer,\n");
+  fprintf(stderr, "                      const, array, base, member, inheritance, subrange\n");
+  fprintf(stderr, "  --attrs <attr,...>  Only decode these attributes: name, linkage_name, byte_size,\n");
+  fprintf(stderr, "                      data_member_location, type, count\n");
+  fprintf(stderr, "  --units <pattern,...> Only dump the units whose name (DW_AT_name) matches a pattern\n");
+  fprintf(stderr, "  --exclude-units <pattern,...>\n");
+  fprintf(stderr, "                      Don't dump the units whose name matches a pattern\n");
+  fprintf(stderr, "  --producers <pattern,...>\n");
+  fprintf(stderr, "                      Only dump the units whose producer (DW_AT_producer) matches a pattern\n");
+  fprintf(stderr, "  --exclude-producers <pattern,...>\n");
+  fprintf(stderr, "                      Don't dump the units whose producer matches a pattern\n");
+  fprintf(stderr, "  --languages <lang,...>\n");
+  fprintf(stderr, "                      Only dump the units of these languages: c, c++, objc, objc++,\n");
+  fprintf(stderr, "                      fortran, go, rust, swift, asm\n");
+  fprintf(stderr, "  --exclude-languages <lang,...>\n");
+  fprintf(stderr, "                      Don't dump the units of these languages\n");
+  fprintf(stderr, "  --threads <count>   Threads parsing the units, chosen from a sample of the units by default\n");
+  fprintf(stderr, "  --verbose           Print how the units are parsed\n");
+  fprintf(stderr, "  --sample <N%%>       Print statistics of the types extrapolated from a random N%% of the units\n");
+  fprintf(stderr, "  --string-table      Output the names once in a \"strings\" array, referenced by index\n");
+  fprintf(stderr, "  --dense-ids         Output the types in a \"types\" array, referenced by index\n");
+  fprintf(stderr, "  --id-map            With --dense-ids, output the DIE offset of each type in \"offsets\"\n");
+  fprintf(stderr, "  --cache <dir>       Keep the types of each unit in dir, the unchanged units are not parsed again\n");
+  fprintf(stderr, "  --write-index <file> Write the types in an index file instead of dumping them\n");
+  fprintf(stderr, "  --index <file>      Dump the types of an index file, with --find only the ones named type_name\n");
+}
+
+// The types are read in place in the index, only the ones dumped are loaded
+static int DumpIndex(const std::string& index_path, const std::string& find_type, 
+                     const TreeBuilder::JsonOptions& json_options) {
+  TypeIndex index;
+  if (!index.Open(index_path)) {
+    return 2;
+  }
+
+  std::vector<uint32_t> roots;
+  if (find_type.empty()) {
+    for (uint32_t i = 0; i < index.ElementCount(); i++) {
+      roots.push_back(i);
+    }
+  } else {
+    index.Lookup(find_type, roots);
+    if (roots.empty()) {
+      fprintf(stderr, "Type '%s' not found\n", find_type.c_str());
+      return 3;
+    }
   }
 
+  TreeBuilder tree_builder;
+  tree_builder.LoadIndexedTypes(index, roots);
+  std::string json = tree_builder.GenerateJson(json_options);
+  printf("%s\n", json.c_str());
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
   std::string target_arch = "arm64e";
-  if (argc > 2) {
-    target_arch = std::string(argv[2]);
+  std::string binary_path;
+  std::string find_type;
+  std::string cache_directory;
+  std::string index_path;
+  std::string write_index_path;
+  std::set<Dwarf32::Tag> tags;
+  std::set<Dwarf32::Attribute> attributes;
+  DwarfFile::UnitFilter unit_filter;
+  unsigned thread_count = 0;
+  bool verbose = false;
+  double sample_percent = 0;
+  TreeBuilder::JsonOptions json_options;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--find") && i+1 < argc) {
+      find_type = argv[++i];
+    } else if (!strcmp(argv[i], "--tags") && i+1 < argc) {
+      if (!ParseNameList(argv[++i], kTagNames, tags)) {
+        PrintUsage(argv[0]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--attrs") && i+1 < argc) {
+      if (!ParseNameList(argv[++i], kAttributeNames, attributes)) {
+        PrintUsage(argv[0]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--units") && i+1 < argc) {
+      unit_filter.names = SplitList(argv[++i]);
+    } else if (!strcmp(argv[i], "--exclude-units") && i+1 < argc) {
+      unit_filter.excluded_names = SplitList(argv[++i]);
+    } else if (!strcmp(argv[i], "--producers") && i+1 < argc) {
+      unit_filter.producers = SplitList(argv[++i]);
+    } else if (!strcmp(argv[i], "--exclude-producers") && i+1 < argc) {
+      unit_filter.excluded_producers = SplitList(argv[++i]);
+    } else if (!strcmp(argv[i], "--languages") && i+1 < argc) {
+      if (!ParseNameList(argv[++i], kLanguageNames, unit_filter.languages)) {
+        PrintUsage(argv[0]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--exclude-languages") && i+1 < argc) {
+      if (!ParseNameList(argv[++i], kLanguageNames, unit_filter.excluded_languages)) {
+        PrintUsage(argv[0]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--threads") && i+1 < argc) {
+      thread_count = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--sample") && i+1 < argc) {
+      char* end = nullptr;
+      sample_percent = strtod(argv[++i], &end);
+      if (*end == '%') {
+        end++;
+      }
+      if (*end || !(sample_percent > 0 && sample_percent <= 100)) {
+        fprintf(stderr, "ERR: Invalid sample '%s'\n", argv[i]);
+        PrintUsage(argv[0]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--verbose")) {
+      verbose = true;
+    } else if (!strcmp(argv[i], "--cache") && i+1 < argc) {
+      cache_directory = argv[++i];
+    } else if (!strcmp(argv[i], "--index") && i+1 < argc) {
+      index_path = argv[++i];
+    } else if (!strcmp(argv[i], "--write-index") && i+1 < argc) {
+      write_index_path = argv[++i];
+    } else if (!strcmp(argv[i], "--string-table")) {
+      json_options.string_table = true;
+    } else if (!strcmp(argv[i], "--dense-ids")) {
+      json_options.dense_ids = true;
+    } else if (!strcmp(argv[i], "--id-map")) {
+      json_options.dense_ids = true;
+      json_options.id_map = true;
+    } else if (!strncmp(argv[i], "--", 2)) {
+      PrintUsage(argv[0]);
+      return 1;
+    } else if (binary_path.empty()) {
+      binary_path = argv[i];
+    } else {
+      target_arch = argv[i];
+    }
+  }
+
+  if (!index_path.empty()) {
+    return DumpIndex(index_path, find_type, json_options);
+  }
+  if (binary_path.empty()) {
+    PrintUsage(argv[0]);
+    return 1;
   }
 
-  std::string binary_path = std::string(argv[1]);
-  ElfFile file;
-  if (!file.Load(binary_path)) {
+  // Mach-O (or dSYM) unless it's an ELF file
+  std::unique_ptr<DwarfFile> file;
+  bool loaded = false;
+  if (IsElfFile(binary_path)) {
+    ElfFile* elf_file = new ElfFile();
+    file.reset(elf_file);
+    loaded = elf_file->Load(binary_path);
+  } else {
+    MachOFile* macho_file = new MachOFile();
+    file.reset(macho_file);
+    loaded = macho_file->Load(binary_path, target_arch);
+  }
+  if (!loaded) {
     fprintf(stderr, "Can't load the file\n");
     return 2;
   }
 
-  file.GetAllClasses();
-  std::string json = file.json();
+  file->SetFilter(tags, attributes);
+  file->SetUnitFilter(unit_filter);
+  file->SetThreadCount(thread_count);
+  file->SetVerbose(verbose);
+  if (!cache_directory.empty() && !file->SetCacheDirectory(cache_directory)) {
+    return 2;
+  }
+  if (sample_percent) {
+    std::string statistics;
+    file->SampleTypes(sample_percent, statistics);
+    printf("%s\n", statistics.c_str());
+    return 0;
+  }
+  // The types of the units read are still dumped when the others can't be
+  bool complete = true;
+  if (!find_type.empty()) {
+    if (!file->FindType(find_type)) {
+      return 3;
+    }
+  } else if (!file->GetAllClasses()) {
+    fprintf(stderr, "ERR: Can't read all the units, the output is partial\n");
+    complete = false;
+  }
+  if (!write_index_path.empty()) {
+    return (file->WriteIndex(write_index_path) && complete) ? 0 : 2;
+  }
+  std::string json = file->json(json_options);
   printf("%s\n", json.c_str());
 
-  return 0;
-}
\ No newline at end of file
+  return complete ? 0 : 2;
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Returns the index of the first NUL byte in [data, data+max_len), or max_len
+// if there is none.
+//
+// The vector paths only issue aligned loads: an aligned load never crosses a
+// page boundary, so reading the few bytes around the range is safe even at the
+// end of a mapping. Matches outside the range are discarded.
+inline size_t FindNulByte(const unsigned char* data, size_t max_len) {
+#if defined(__AVX2__) || defined(__SSE2__) || defined(__ARM_NEON)
+#if defined(__AVX2__)
+  const size_t kVectorSize = 32;
+  const __m256i zero = _mm256_setzero_si256();
+  auto nul_mask = [&](const unsigned char* block) -> uint64_t {
+    __m256i chunk = _mm256_load_si256(reinterpret_cast<const __m256i*>(block));
+    return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, zero)));
+  };
+  const unsigned int kBitsPerByte = 1;
+#elif defined(__SSE2__)
+  const size_t kVectorSize = 16;
+  const __m128i zero = _mm_setzero_si128();
+  auto nul_mask = [&](const unsigned char* block) -> uint64_t {
+    __m128i chunk = _mm_load_si128(reinterpret_cast<const __m128i*>(block));
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, zero)));
+  };
+  const unsigned int kBitsPerByte = 1;
+#else
+  // NEON has no movemask, narrow every compared byte to a nibble instead
+  const size_t kVectorSize = 16;
+  auto nul_mask = [&](const unsigned char* block) -> uint64_t {
+    uint8x16_t cmp = vceqq_u8(vld1q_u8(block), vdupq_n_u8(0));
+    uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+  };
+  const unsigned int kBitsPerByte = 4;
+#endif
+
+  if (!max_len) {
+    return 0;
+  }
+
+  size_t misalign = reinterpret_cast<uintptr_t>(data) & (kVectorSize - 1);
+  const unsigned char* block = data - misalign;
+
+  // First block: ignore the bytes located before data
+  uint64_t mask = nul_mask(block) >> (misalign * kBitsPerByte);
+  size_t scanned = 0;
+  while (!mask) {
+    scanned += (scanned ? kVectorSize : kVectorSize - misalign);
+    if (scanned >= max_len) {
+      return max_len;
+    }
+    mask = nul_mask(data + scanned);
+  }
+
+  size_t index = scanned + __builtin_ctzll(mask) / kBitsPerByte;
+  return index < max_len ? index : max_len;
+#else
+  const void* nul = memchr(data, 0, max_len);
+  return nul ? static_cast<const unsigned char*>(nul) - data : max_len;
+#endif
+}
@@ -0,0 +1,69 @@
+; Types in namespaces, for the Apple accelerator tables of a Mach-O dSYM:
+;   namespace a { struct Foo { int a_member; }; Foo foo;
+;                 namespace b { struct Foo { long b_member; }; Foo foo; } }
+;   namespace c { struct Foo { struct Nested { short nested_member; }; }; Foo::Nested nested; }
+;   struct Foo { char global_member; }; Foo foo;
+; Written by hand, without clang: see the data/apple_tables rule of Makefile
+target datalayout = "e-m:o-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-apple-macosx10.15.0"
+
+%"struct.a::Foo" = type { i32 }
+%"struct.a::b::Foo" = type { i64 }
+%"struct.c::Foo::Nested" = type { i16 }
+%struct.Foo = type { i8 }
+
+@_ZN1a3fooE = global %"struct.a::Foo" zeroinitializer, align 4, !dbg !0
+@_ZN1a1b3fooE = global %"struct.a::b::Foo" zeroinitializer, align 8, !dbg !10
+@_ZN1c6nestedE = global %"struct.c::Foo::Nested" zeroinitializer, align 2, !dbg !20
+@foo = global %struct.Foo zeroinitializer, align 1, !dbg !30
+
+define i32 @main() !dbg !40 {
+  ret i32 0, !dbg !43
+}
+
+!llvm.dbg.cu = !{!50}
+!llvm.module.flags = !{!52, !53}
+
+!0 = !DIGlobalVariableExpression(var: !1, expr: !DIExpression())
+!1 = distinct !DIGlobalVariable(name: "foo", linkageName: "_ZN1a3fooE", scope: !2, file: !51, line: 2, type: !3, isLocal: false, isDefinition: true)
+!2 = !DINamespace(name: "a", scope: null)
+!3 = distinct !DICompositeType(tag: DW_TAG_structure_type, name: "Foo", scope: !2, file: !51, line: 2, size: 32, flags: DIFlagTypePassByValue, elements: !4, identifier: "_ZTSN1a3FooE")
+!4 = !{!5}
+!5 = !DIDerivedType(tag: DW_TAG_member, name: "a_member", scope: !3, file: !51, line: 2, baseType: !6, size: 32)
+!6 = !DIBasicType(name: "int", size: 32, encoding: DW_ATE_signed)
+
+!10 = !DIGlobalVariableExpression(var: !11, expr: !DIExpression())
+!11 = distinct !DIGlobalVariable(name: "foo", linkageName: "_ZN1a1b3fooE", scope: !12, file: !51, line: 3, type: !13, isLocal: false, isDefinition: true)
+!12 = !DINamespace(name: "b", scope: !2)
+!13 = distinct !DICompositeType(tag: DW_TAG_structure_type, name: "Foo", scope: !12, file: !51, line: 3, size: 64, flags: DIFlagTypePassByValue, elements: !14, identifier: "_ZTSN1a1b3FooE")
+!14 = !{!15}
+!15 = !DIDerivedType(tag: DW_TAG_member, name: "b_member", scope: !13, file: !51, line: 3, baseType: !16, size: 64)
+!16 = !DIBasicType(name: "long", size: 64, encoding: DW_ATE_signed)
+
+!20 = !DIGlobalVariableExpression(var: !21, expr: !DIExpression())
+!21 = distinct !DIGlobalVariable(name: "nested", linkageName: "_ZN1c6nestedE", scope: !22, file: !51, line: 4, type: !24, isLocal: false, isDefinition: true)
+!22 = !DINamespace(name: "c", scope: null)
+!23 = distinct !DICompositeType(tag: DW_TAG_structure_type, name: "Foo", scope: !22, file: !51, line: 4, size: 8, flags: DIFlagTypePassByValue, elements: !27, identifier: "_ZTSN1c3FooE")
+!24 = distinct !DICompositeType(tag: DW_TAG_structure_type, name: "Nested", scope: !23, file: !51, line: 4, size: 16, flags: DIFlagTypePassByValue, elements: !25, identifier: "_ZTSN1c3Foo6NestedE")
+!25 = !{!26}
+!26 = !DIDerivedType(tag: DW_TAG_member, name: "nested_member", scope: !24, file: !51, line: 4, baseType: !28, size: 16)
+!27 = !{}
+!28 = !DIBasicType(name: "short", size: 16, encoding: DW_ATE_signed)
+
+!30 = !DIGlobalVariableExpression(var: !31, expr: !DIExpression())
+!31 = distinct !DIGlobalVariable(name: "foo", scope: null, file: !51, line: 5, type: !32, isLocal: false, isDefinition: true)
+!32 = distinct !DICompositeType(tag: DW_TAG_structure_type, name: "Foo", file: !51, line: 5, size: 8, flags: DIFlagTypePassByValue, elements: !33, identifier: "_ZTS3Foo")
+!33 = !{!34}
+!34 = !DIDerivedType(tag: DW_TAG_member, name: "global_member", scope: !32, file: !51, line: 5, baseType: !35, size: 8)
+!35 = !DIBasicType(name: "char", size: 8, encoding: DW_ATE_signed_char)
+
+!40 = distinct !DISubprogram(name: "main", scope: !51, file: !51, line: 6, type: !41, scopeLine: 6, spFlags: DISPFlagDefinition, unit: !50)
+!41 = !DISubroutineType(types: !42)
+!42 = !{!6}
+!43 = !DILocation(line: 6, column: 13, scope: !40)
+
+!50 = distinct !DICompileUnit(language: DW_LANG_C_plus_plus_14, file: !51, producer: "hand-written", isOptimized: false, runtimeVersion: 0, emissionKind: FullDebug, globals: !54)
+!51 = !DIFile(filename: "apple_tables.cc", directory: "/tmp")
+!52 = !{i32 7, !"Dwarf Version", i32 4}
+!53 = !{i32 2, !"Debug Info Version", i32 3}
+!54 = !{!0, !10, !20, !30}
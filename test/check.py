@@ -0,0 +1,322 @@
+#!/usr/bin/env python
+# Check the dumper on the samples of data/:
+#   check.py ../build/dwarf_dumper [--update]
+# The outputs of each sample must match the expected ones of expected/,
+# --update rewrites them after an intended change. The options which only
+# change the encoding or the way the DIEs are parsed must give the same types
+# as the default output, on the samples and on a binary of many units
+# generated with $CXX, big enough to be parsed by several threads.
+import json
+import os
+import re
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+
+TEST_DIR = os.path.dirname(os.path.abspath(__file__))
+DATA_DIR = os.path.join(TEST_DIR, "data")
+EXPECTED_DIR = os.path.join(TEST_DIR, "expected")
+
+# Sample, and the arguments of each expected output
+EXPECTED = [
+  ("dwarf4", [[], ["--find", "classA"]]),
+  ("dwarf4_types", [[], ["--find", "classA"]]),
+  ("dwarf5_gdb_index", [[], ["--find", "classA"]]),
+  # The qualified names without accelerator table, with .gdb_index and with
+  # .debug_names
+  ("scopes_dwarf4", [[], ["--find", "Foo"], ["--find", "a::Foo"], ["--find", "a::b::Foo"], ["--find", "b::Foo"],
+                     ["--find", "::Foo"], ["--find", "c::Foo::Nested"], ["--find", "(anonymous namespace)::Foo"]]),
+  ("scopes_gdb_index", [[], ["--find", "Foo"], ["--find", "a::Foo"], ["--find", "a::b::Foo"], ["--find", "::Foo"],
+                        ["--find", "(anonymous namespace)::Foo"]]),
+  ("scopes_debug_names", [[], ["--find", "Thing"], ["--find", "inner::Thing"], ["--find", "deeper::Thing"],
+                          ["--find", "scopes::other::Thing"], ["--find", "::scopes::Thing"]]),
+  # The definitions of the type units which take the scope of their declaration
+  ("specification_types", [[], ["--find", "common::Fwd"], ["--find", "common::Shared::Inner"]]),
+  # The qualified names with the Apple accelerator tables of a Mach-O dSYM
+  ("apple_tables", [[], ["--find", "Foo"], ["--find", "a::Foo"], ["--find", "a::b::Foo"], ["--find", "::Foo"],
+                    ["--find", "c::Foo::Nested"]]),
+]
+
+# Samples with type units: the declarations of their types, the stubs of
+# DW_AT_signature and the ones of DW_AT_specification, must be merged
+MERGED = ["dwarf4_types", "specification_types"]
+
+# Sample, name, and the DIE offsets of the types which --find must return
+# (llvm-dwarfdump --debug-info), without the ones of the other scopes
+FOUND = [
+  ("apple_tables", "Foo", [72, 124, 192, 253], []),
+  ("apple_tables", "a::Foo", [72], [124, 192, 253]),
+  ("apple_tables", "a::b::Foo", [124], [72, 192, 253]),
+  ("apple_tables", "::Foo", [253], [72, 124, 192]),
+  ("apple_tables", "c::Foo::Nested", [201], [72, 124, 192, 253]),
+]
+
+failures = []
+
+def fail(message):
+  failures.append(message)
+  print("  FAIL: %s" % message)
+
+def run(dumper, args):
+  process = subprocess.run([dumper] + args, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+  if process.returncode:
+    fail("%s exited with %d" % (" ".join(args), process.returncode))
+  return process
+
+def dump(dumper, args):
+  output = run(dumper, args).stdout
+  return json.loads(output) if output else None
+
+def expected_name(sample, args):
+  return "-".join([sample] + [re.sub("[^A-Za-z0-9_]", "_", arg.lstrip("-")) for arg in args]) + ".json"
+
+def check_expected(dumper, update):
+  for sample, args_list in EXPECTED:
+    for args in args_list:
+      name = expected_name(sample, args)
+      output = run(dumper, args + [os.path.join(DATA_DIR, sample)]).stdout
+      path = os.path.join(EXPECTED_DIR, name)
+      if update:
+        with open(path, "wb") as f:
+          f.write(output)
+      with open(path, "rb") as f:
+        if f.read() != output:
+          fail("%s differs from the expected output" % name)
+
+def check_merged(dumper, sample):
+  # A declaration has neither a size nor members
+  types = dump(dumper, [os.path.join(DATA_DIR, sample)])
+  aggregates = ("structure", "class", "union")
+  defined = set((element.get("scope"), element.get("name")) for element in types.values()
+                if element["type"] in aggregates and "size" in element)
+  for id, element in types.items():
+    if element["type"] not in aggregates or "size" in element or "members" in element:
+      continue
+    if "name" not in element:
+      fail("%s: the stub %s isn't merged into its type unit" % (sample, id))
+    elif (element.get("scope"), element["name"]) in defined:
+      fail("%s: the declaration %s isn't merged into its definition" % (sample, id))
+
+def check_found(dumper, sample, name, found, not_found):
+  types = dump(dumper, ["--find", name, os.path.join(DATA_DIR, sample)]) or {}
+  for offset in found:
+    if str(offset) not in types:
+      fail("%s: --find %s doesn't return the DIE 0x%x" % (sample, name, offset))
+  for offset in not_found:
+    if str(offset) in types:
+      fail("%s: --find %s returns the DIE 0x%x of another scope" % (sample, name, offset))
+
+def section_offset(binary, name):
+  # File offset of a section of an ELF64 binary
+  with open(binary, "rb") as f:
+    data = f.read()
+  shoff, = struct.unpack_from("<Q", data, 0x28)
+  shentsize, shnum, shstrndx = struct.unpack_from("<HHH", data, 0x3a)
+  names = struct.unpack_from("<Q", data, shoff + shstrndx * shentsize + 0x18)[0]
+  for i in range(shnum):
+    header = shoff + i * shentsize
+    section_name = data[names + struct.unpack_from("<I", data, header)[0]:].split(b"\0", 1)[0]
+    if section_name == name:
+      return struct.unpack_from("<Q", data, header + 0x18)[0]
+  return None
+
+def check_partial(dumper, sample, work_dir):
+  # The last unit of the sample is cut by a length past the end of
+  # .debug_info: the types of the first one are dumped, with an error
+  with open(os.path.join(DATA_DIR, sample), "rb") as f:
+    data = bytearray(f.read())
+  info = section_offset(os.path.join(DATA_DIR, sample), b".debug_info")
+  last_unit = info + struct.unpack_from("<I", data, info)[0] + 4
+  struct.pack_into("<I", data, last_unit, 0xffffff00)
+  binary = os.path.join(work_dir, sample + ".partial")
+  with open(binary, "wb") as f:
+    f.write(data)
+  process = subprocess.run([dumper, binary], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+  if not process.returncode:
+    fail("%s: a truncated .debug_info exits with 0" % sample)
+  elif not process.stdout or not json.loads(process.stdout):
+    fail("%s: the units before a truncated one aren't dumped" % sample)
+
+def without_placeholders(types):
+  return {id: element for id, element in types.items() if element["type"] != "none"}
+
+def resolve_strings(output):
+  # --string-table: the names and scopes are indexes in "strings"
+  strings = output.pop("strings")
+  def resolve(value):
+    if isinstance(value, dict):
+      return {key: strings[item] if key in ("name", "scope") else resolve(item) for key, item in value.items()}
+    if isinstance(value, list):
+      return [resolve(item) for item in value]
+    return value
+  return resolve(output)
+
+def resolve_dense_ids(output):
+  # --dense-ids --id-map: the references are indexes in "types", "offsets"
+  # has the DIE offset of each one
+  offsets = output["offsets"]
+  def resolve(value):
+    if isinstance(value, dict):
+      return {key: str(offsets[item]) if key in ("type_id", "id") else resolve(item) for key, item in value.items()}
+    if isinstance(value, list):
+      return [resolve(item) for item in value]
+    return value
+  return {str(offset): resolve(element) for offset, element in zip(offsets, output["types"])}
+
+def without_dangling_references(types):
+  # The dense ids omit the references to the DIEs which aren't dumped
+  def clean(value):
+    if isinstance(value, dict):
+      return {key: clean(item) for key, item in value.items() if key not in ("type_id", "id") or item in types}
+    if isinstance(value, list):
+      return [clean(item) for item in value]
+    return value
+  return clean(types)
+
+def type_structures(types):
+  # The ids of the copies of a type depend on the units parsed: the types are
+  # compared by their fields, and the ones of the types they reference
+  def structure(id, depth):
+    element = types.get(id)
+    if element is None or depth == 0:
+      return element and [element["type"], element.get("scope"), element.get("name")]
+    fields = dict(element)
+    if "type_id" in fields:
+      fields["type_id"] = structure(fields["type_id"], depth - 1)
+    for key, id_key in (("members", "type_id"), ("parents", "id")):
+      if key in fields:
+        fields[key] = [dict(item, **{id_key: structure(item.get(id_key), depth - 1)}) for item in fields[key]]
+    return fields
+  return sorted(json.dumps(structure(id, 3), sort_keys=True) for id in types)
+
+def check_equivalences(dumper, binary, work_dir, found_names):
+  name = os.path.basename(binary)
+  default = dump(dumper, [binary])
+
+  for threads in ["1", "4"]:
+    if dump(dumper, ["--threads", threads, binary]) != default:
+      fail("%s: --threads %s differs from the default output" % (name, threads))
+
+  if resolve_strings(dump(dumper, ["--string-table", binary])) != default:
+    fail("%s: --string-table differs from the default output" % name)
+
+  dense = resolve_dense_ids(dump(dumper, ["--dense-ids", "--id-map", binary]))
+  if dense != without_dangling_references(without_placeholders(default)):
+    fail("%s: --dense-ids differs from the default output" % name)
+
+  cache_dir = os.path.join(work_dir, name + ".cache")
+  for run_name in ["cold", "warm"]:
+    if dump(dumper, ["--cache", cache_dir, binary]) != default:
+      fail("%s: --cache differs from the default output (%s run)" % (name, run_name))
+
+  index = os.path.join(work_dir, name + ".index")
+  run(dumper, ["--write-index", index, binary])
+  if dump(dumper, ["--index", index]) != without_placeholders(default):
+    fail("%s: --index differs from the default output" % name)
+
+  # --find parses the types found and their references, the index has them
+  # all merged and deduplicated
+  for type_name in found_names:
+    found = without_placeholders(dump(dumper, ["--find", type_name, binary]) or {})
+    indexed = without_placeholders(dump(dumper, ["--index", index, "--find", type_name]) or {})
+    if not found or type_structures(found) != type_structures(indexed):
+      fail("%s: --find %s differs from the one of --index" % (name, type_name))
+
+def generate_binary(work_dir):
+  # Units sharing the types of a header, to be deduplicated across the chunks
+  # of the threads
+  units = 40
+  structs = 400
+  header = ["#include <stdint.h>", "namespace shared {"]
+  for i in range(64):
+    header.append("struct Shared%d { int a; long b[%d]; Shared%d* next; };" % (i, i + 1, i))
+  header.append("template <typename T> struct Box { T value; Box* next; };")
+  header.append("}")
+  with open(os.path.join(work_dir, "shared.h"), "w") as f:
+    f.write("\n".join(header) + "\n")
+
+  sources = []
+  for unit in range(units):
+    source = ['#include "shared.h"', "namespace unit%d {" % unit]
+    for i in range(structs):
+      if i % 50 == 0:
+        source.append("enum class Kind%d { kA, kB };" % i)
+      previous = max(i - 1, 0)
+      source.append("struct Type%d { int a; uint8_t b; double c[3]; shared::Shared%d* s; "
+                    "shared::Box<Type%d>* box; Type%d* prev; union { int i; float f; } u; "
+                    "const char* name; };" % (i, i % 64, previous, previous))
+    source.append("}")
+    source.append("int UnitMain%d() { return 0; }" % unit)
+    sources.append(os.path.join(work_dir, "unit%d.cc" % unit))
+    with open(sources[-1], "w") as f:
+      f.write("\n".join(source) + "\n")
+  sources.append(os.path.join(work_dir, "main.cc"))
+  with open(sources[-1], "w") as f:
+    f.write("int main() { return 0; }\n")
+
+  compiler = os.environ.get("CXX", "c++")
+  objects = []
+  processes = []
+  for source in sources:
+    objects.append(source[:-len(".cc")] + ".o")
+    processes.append(subprocess.Popen([compiler, "-g", "-fno-eliminate-unused-debug-types", "-c", source,
+                                       "-o", objects[-1]]))
+  if any(process.wait() for process in processes):
+    return None
+  binary = os.path.join(work_dir, "units")
+  subprocess.run([compiler] + objects + ["-o", binary], check=True)
+  return binary
+
+def check_parallel_plan(dumper, binary):
+  # The equivalence of --threads only means something with several chunks
+  verbose = run(dumper, ["--verbose", "--threads", "4", binary]).stderr.decode()
+  total = re.search(r"(\d+) KB of DIEs", verbose)
+  chunk = re.search(r"chunks of (\d+) KB", verbose)
+  if not total or not chunk or int(total.group(1)) < 2 * int(chunk.group(1)):
+    fail("%s: not parsed in several chunks" % os.path.basename(binary))
+
+def main():
+  if len(sys.argv) < 2:
+    print("Format: %s <dwarf_dumper> [--update]" % sys.argv[0])
+    sys.exit(1)
+  dumper = os.path.abspath(sys.argv[1])
+  update = "--update" in sys.argv[2:]
+
+  print("Expected outputs")
+  check_expected(dumper, update)
+  for sample in MERGED:
+    print("Merged declarations: %s" % sample)
+    check_merged(dumper, sample)
+  for sample, name, found, not_found in FOUND:
+    print("Found types: %s %s" % (sample, name))
+    check_found(dumper, sample, name, found, not_found)
+
+  work_dir = tempfile.mkdtemp()
+  try:
+    print("Partial output: dwarf4")
+    check_partial(dumper, "dwarf4", work_dir)
+
+    for sample, args_list in EXPECTED:
+      print("Equivalent options: %s" % sample)
+      found_names = [args[1] for args in args_list if args[:1] == ["--find"]]
+      check_equivalences(dumper, os.path.join(DATA_DIR, sample), work_dir, found_names)
+
+    print("Equivalent options: generated units")
+    binary = generate_binary(work_dir)
+    if binary:
+      check_parallel_plan(dumper, binary)
+      check_equivalences(dumper, binary, work_dir, ["Type5", "shared::Shared3", "shared::Box<unit7::Type12>"])
+    else:
+      fail("can't compile the generated units")
+  finally:
+    shutil.rmtree(work_dir)
+
+  if failures:
+    print("%d checks failed" % len(failures))
+    sys.exit(1)
+  print("All checks passed")
+
+if __name__ == "__main__":
+  main()
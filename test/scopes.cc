@@ -0,0 +1,46 @@
+// Types with the same name in several scopes, for the qualified names of
+// --find
+namespace a {
+struct Foo {
+  int a_member;
+};
+namespace b {
+struct Foo {
+  long b_member;
+};
+}
+}
+
+namespace c {
+struct Foo {
+  char c_member;
+  struct Nested {
+    a::Foo foo;
+  };
+  Nested nested;
+};
+}
+
+namespace {
+struct Foo {
+  float anonymous_member;
+};
+Foo anonymous_foo;
+}
+
+struct Foo {
+  double global_member;
+};
+
+int main() {
+  struct Foo {
+    short local_member;
+  };
+  Foo local;
+  a::Foo a_foo;
+  a::b::Foo b_foo;
+  c::Foo c_foo;
+  ::Foo global_foo;
+  ::Foo* global_pointer = &global_foo;
+  return local.local_member + a_foo.a_member + b_foo.b_member + c_foo.c_member + global_foo.global_member;
+}
@@ -0,0 +1,27 @@
+// Types with the same name in several modules, for the qualified names of
+// --find with .debug_names
+pub mod inner {
+    pub struct Thing {
+        pub inner_member: u32,
+    }
+    pub mod deeper {
+        pub struct Thing {
+            pub deeper_member: u64,
+        }
+    }
+}
+
+pub mod other {
+    pub struct Thing {
+        pub other_member: u8,
+    }
+}
+
+pub struct Thing {
+    pub root_member: i16,
+}
+
+#[no_mangle]
+pub extern "C" fn things(a: &inner::Thing, b: &inner::deeper::Thing, c: &other::Thing, d: &Thing) -> u64 {
+    a.inner_member as u64 + b.deeper_member + c.other_member as u64 + d.root_member as u64
+}
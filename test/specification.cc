@@ -0,0 +1,26 @@
+// Types defined out of their namespace or class: with -fdebug-types-section
+// the definitions refer to their declaration with DW_AT_specification
+namespace common {
+struct Fwd;
+struct Shared {
+  struct Inner;
+  Inner* inner;
+  int shared_member;
+};
+}
+
+struct common::Fwd {
+  int fwd_member;
+};
+
+struct common::Shared::Inner {
+  common::Fwd* fwd;
+  long inner_member;
+};
+
+common::Fwd fwd;
+common::Shared shared;
+common::Shared::Inner inner;
+common::Fwd* fwd_pointer = &fwd;
+
+int main() { return fwd.fwd_member + shared.shared_member + inner.inner_member; }